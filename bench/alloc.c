@@ -0,0 +1,67 @@
+#include "bench.h"
+#include <stdlib.h>
+#include <string.h>
+// alloc/free throughput of strings and small int arrays held in a rotating set of old-space slots,
+// once through the runtime pools and once through malloc/free of the same sizes (run with CRUNCHY_GC_NURSERY=0)
+#define SLOTS 4096
+#define BATCH 16384
+Type t_array_int = {.kind = TY_ARRAY, .subtype = &t_int};
+BENCH_FRAME(MemoryBlock *slots[SLOTS];) frame0;
+static char chars[] = "0123456789012345678901234567890123456789";
+
+static void pools(int64_t n)
+{
+	for(int64_t i = 0; i < n; i++) {
+		// a frame per object, like a call in generated code, so the collector reaches its safepoints
+		BENCH_FRAME() frame = {{0}};
+		BENCH_PUSH(frame);
+		if(i & 1) frame0.slots[i % SLOTS] = (MemoryBlock*)new_string(i % 40, chars);
+		else frame0.slots[i % SLOTS] = (MemoryBlock*)new_array(&t_array_int, i % 8, 0L, 1L, 2L, 3L, 4L, 5L, 6L, 7L);
+		pop_frame();
+	}
+}
+
+// objects die SLOTS allocations later and are freed in batches, as the sweep of a malloc based collector would free them
+static void mallocs(int64_t n)
+{
+	static void *history[SLOTS + BATCH][2];
+	for(int64_t i = 0; i < n; i++) {
+		void **object = history[i % (SLOTS + BATCH)];
+		if(i & 1) {
+			String *string = malloc(sizeof(String) + i % 40 + 1);
+			string->length = i % 40;
+			string->chars = (char*)(string + 1);
+			memcpy(string->chars, chars, i % 40);
+			object[0] = string;
+			object[1] = NULL;
+		} else {
+			Array *array = malloc(sizeof(Array));
+			array->length = array->capacity = i % 8;
+			array->items = i % 8 ? calloc(i % 8, sizeof(int64_t)) : NULL;
+			for(int64_t j = 0; j < i % 8; j++) ((int64_t*)array->items)[j] = j;
+			object[0] = array;
+			object[1] = array->items;
+		}
+		if((i + 1) % BATCH) continue;
+		for(int64_t j = i + 1 - SLOTS - BATCH; j <= i - SLOTS; j++) {
+			if(j < 0) continue;
+			free(history[j % (SLOTS + BATCH)][0]);
+			free(history[j % (SLOTS + BATCH)][1]);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int64_t n = argc > 1 ? atoll(argv[1]) : 2000000;
+	BENCH_PUSH(frame0);
+	int64_t start = now_ns();
+	pools(n);
+	double pool_time = (now_ns() - start) * 1e-9;
+	start = now_ns();
+	mallocs(n);
+	double malloc_time = (now_ns() - start) * 1e-9;
+	printf("pools  %6.1f M allocs/s\n", n / pool_time / 1e6);
+	printf("malloc %6.1f M allocs/s\n", n / malloc_time / 1e6);
+	pop_frame();
+}
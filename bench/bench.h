@@ -0,0 +1,19 @@
+#include "runtime.h"
+#include <time.h>
+
+// a frame laid out like those of generated code: the Frame header followed by the gc slots given in fields
+#define BENCH_FRAME(fields) struct { Frame header; fields }
+
+// link frame to the current one and count its slots, then make it the current frame
+#define BENCH_PUSH(frame) do { \
+	(frame).header.parent = get_cur_frame(); \
+	(frame).header.num_gc_decls = (sizeof(frame) - sizeof(Frame)) / sizeof(MemoryBlock*); \
+	push_frame(&(frame)); \
+} while(0)
+
+static int64_t now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000 + t.tv_nsec;
+}
@@ -0,0 +1,145 @@
+#include "bench.h"
+#include <stdlib.h>
+#include <string.h>
+// ns per lookup in string => int and int => int maps against a linear scan over the keys and a chained hash table
+// of malloc'd nodes that uses the same string hash
+#define LOOKUPS 2000000
+Type t_map_string_int = {.kind = TY_MAP, .keytype = &t_string, .subtype = &t_int};
+Type t_map_int_int = {.kind = TY_MAP, .keytype = &t_int, .subtype = &t_int};
+Type t_array_string = {.kind = TY_ARRAY, .subtype = &t_string};
+BENCH_FRAME(Map *strings; Map *ints; Array *keys;) frame0;
+static volatile int64_t sink;
+
+typedef struct Node {
+	struct Node *next;
+	String *key;
+	int64_t value;
+} Node;
+
+static uint64_t hash_string(String *string)
+{
+	char *chars = string->chars;
+	uint64_t hash = string->length;
+	uint64_t word = 0;
+
+	for(int64_t left = string->length; left > 0; left -= 8, chars += 8) {
+		memcpy(&word, chars, left < 8 ? left : 8);
+		hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+		hash ^= hash >> 29;
+		word = 0;
+	}
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ull;
+	return hash ^ hash >> 33;
+}
+
+static int64_t same_string(String *a, String *b)
+{
+	return a->length == b->length && !memcmp(a->chars, b->chars, a->length);
+}
+
+static void column(double ns)
+{
+	if(ns < 0) printf("        -");
+	else printf(" %8.1f", ns);
+}
+
+static void run(int64_t n)
+{
+	int64_t buckets = 1;
+	while(buckets < n) buckets *= 2;
+	Node **table = calloc(buckets, sizeof(Node*));
+	int64_t *ints = malloc(n * sizeof(int64_t));
+	frame0.strings = new_map(&t_map_string_int);
+	frame0.ints = new_map(&t_map_int_int);
+	frame0.keys = new_array(&t_array_string, 0);
+
+	for(int64_t i = 0; i < n; i++) {
+		char chars[32];
+		int length = snprintf(chars, sizeof(chars), "identifier%li", i * 7919);
+		array_push(frame0.keys, new_string(length, chars));
+		String *key = ((String**)frame0.keys->items)[i];
+		map_set(frame0.strings, key, i);
+		ints[i] = i * 7919;
+		map_set(frame0.ints, ints[i], i);
+		Node *node = malloc(sizeof(Node));
+		Node **bucket = &table[hash_string(key) & (buckets - 1)];
+		*node = (Node){*bucket, key, i};
+		*bucket = node;
+	}
+
+	String **keys = frame0.keys->items;
+	// the linear scans only run up to 1000 keys, with fewer lookups the longer the scan
+	int64_t scans = n <= 1000 ? LOOKUPS / (n / 10 + 1) : 0;
+	int64_t sum = 0;
+	int64_t start;
+
+	printf("%8li", n);
+	start = now_ns();
+	for(int64_t j = 0; j < LOOKUPS; j++) sum += map_get(frame0.strings, keys[j * 31 % n]);
+	column((double)(now_ns() - start) / LOOKUPS);
+
+	start = now_ns();
+	for(int64_t j = 0; j < LOOKUPS; j++) {
+		String *key = keys[j * 31 % n];
+		for(Node *node = table[hash_string(key) & (buckets - 1)]; node; node = node->next) {
+			if(same_string(node->key, key)) {
+				sum += node->value;
+				break;
+			}
+		}
+	}
+	column((double)(now_ns() - start) / LOOKUPS);
+
+	start = now_ns();
+	for(int64_t j = 0; j < scans; j++) {
+		String *key = keys[j * 31 % n];
+		for(int64_t i = 0; i < n; i++) {
+			if(same_string(keys[i], key)) {
+				sum += i;
+				break;
+			}
+		}
+	}
+	column(scans ? (double)(now_ns() - start) / scans : -1);
+
+	start = now_ns();
+	for(int64_t j = 0; j < LOOKUPS; j++) sum += map_get(frame0.ints, ints[j * 31 % n]);
+	column((double)(now_ns() - start) / LOOKUPS);
+
+	start = now_ns();
+	for(int64_t j = 0; j < scans; j++) {
+		int64_t key = ints[j * 31 % n];
+		for(int64_t i = 0; i < n; i++) {
+			if(ints[i] == key) {
+				sum += i;
+				break;
+			}
+		}
+	}
+	column(scans ? (double)(now_ns() - start) / scans : -1);
+	printf("\n");
+
+	for(int64_t i = 0; i < buckets; i++) {
+		for(Node *node = table[i], *next; node; node = next) {
+			next = node->next;
+			free(node);
+		}
+	}
+	free(table);
+	free(ints);
+	sink = sum;
+}
+
+int main(int argc, char **argv)
+{
+	int64_t sizes[] = {100, 1000, 100000, 1000000};
+	BENCH_PUSH(frame0);
+	printf("       n   string  chained   linear      int   linear\n");
+	if(argc > 1) run(atoll(argv[1]));
+	else for(int64_t i = 0; i < 4; i++) run(sizes[i]);
+	pop_frame();
+}
@@ -0,0 +1,58 @@
+#include "bench.h"
+#include <stdlib.h>
+// pause distribution while the live heap grows: each step allocates a string that stays reachable for a while,
+// so objects keep getting promoted and major collections keep running. A step that did collector work counts as
+// a pause, timed from outside (compare a plain run with CRUNCHY_GC_INCREMENTAL=1)
+#define RECENT 4096
+#define ROW 1024
+Type t_array_string = {.kind = TY_ARRAY, .subtype = &t_string};
+Type t_rows = {.kind = TY_ARRAY, .subtype = &t_array_string};
+BENCH_FRAME(Array *live; Array *row; MemoryBlock *recent[RECENT];) frame0;
+static char chars[] = "0123456789012345678901234567890123456789";
+
+static int compare_ns(const void *a, const void *b)
+{
+	int64_t x = *(int64_t*)a;
+	int64_t y = *(int64_t*)b;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+	int64_t max_live = argc > 1 ? atoll(argv[1]) : 1600000;
+	int64_t *times = malloc(max_live * 4 * sizeof(int64_t));
+	BENCH_PUSH(frame0);
+	frame0.live = new_array(&t_rows, 0);
+	printf("live objects  majors   pauses   p50 us   p99 us   max us\n");
+	for(int64_t live = max_live / 16; live <= max_live; live *= 2) {
+		// the live set is kept in rows, so no single array has to be marked in one step
+		while(frame0.live->length * ROW < live) {
+			frame0.row = new_array(&t_array_string, 0);
+			for(int64_t i = 0; i < ROW; i++) {
+				array_push(frame0.row, new_string(i % 40, chars));
+			}
+			array_push(frame0.live, frame0.row);
+		}
+		int64_t steps = live * 4;
+		GcStats before, stats;
+		get_gc_stats(&before);
+		stats = before;
+		int64_t pauses = 0;
+		for(int64_t i = 0; i < steps; i++) {
+			BENCH_FRAME() frame = {{0}};
+			int64_t pause_ns = stats.pause_ns;
+			int64_t start = now_ns();
+			BENCH_PUSH(frame);
+			frame0.recent[i % RECENT] = (MemoryBlock*)new_string(i % 40, chars);
+			pop_frame();
+			int64_t time = now_ns() - start;
+			get_gc_stats(&stats);
+			if(stats.pause_ns != pause_ns) times[pauses++] = time;
+		}
+		if(!pauses) continue;
+		qsort(times, pauses, sizeof(int64_t), compare_ns);
+		printf("%12li %7li %8li %8.1f %8.1f %8.1f\n", live, stats.major_collections - before.major_collections, pauses,
+			times[pauses / 2] / 1e3, times[pauses * 99 / 100] / 1e3, times[pauses - 1] / 1e3);
+	}
+	pop_frame();
+}
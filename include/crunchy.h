@@ -26,6 +26,28 @@
 	_(']', RBRACK) \
 	_('+', PLUS) \
 
+#define BUILTINS \
+	_(push) \
+	_(slice) \
+	_(spawn) \
+	_(wait) \
+	_(sum) \
+	_(min) \
+	_(max) \
+	_(count) \
+	_(find) \
+	_(fill) \
+	_(copy) \
+	_(get) \
+	_(set) \
+	_(has) \
+	_(delete) \
+	_(readfile) \
+	_(readline) \
+	_(eof) \
+	_(lines) \
+	_(parseint) \
+
 #define TYPES \
 	_(UNKNOWN) \
 	_(VOID) \
@@ -34,6 +56,7 @@
 	_(STRING) \
 	_(FUNC) \
 	_(ARRAY) \
+	_(MAP) \
 
 typedef enum : uint8_t {
 	TK_BOF,
@@ -51,6 +74,8 @@ typedef enum : uint8_t {
 	PUNCTS
 	#undef _
 
+	PT_ARROW,
+
 	TYPE_KIND_START,
 
 	#define _(a) TY_ ## a,
@@ -68,6 +93,7 @@ typedef enum : uint8_t {
 	EX_BINOP,
 	EX_CALL,
 	EX_ARRAY,
+	EX_MAP,
 
 	STMT_KIND_START,
 
@@ -79,6 +105,14 @@ typedef enum : uint8_t {
 	ST_IF,
 } Kind;
 
+typedef enum {
+	BI_NONE,
+
+	#define _(a) BI_ ## a,
+	BUILTINS
+	#undef _
+} Builtin;
+
 typedef struct {
 	Kind kind;
 	char *start;
@@ -95,7 +129,9 @@ typedef struct {
 
 typedef struct Type {
 	Kind kind;
-	struct Type *subtype; // array
+	uint32_t id; // runtime type index
+	struct Type *subtype; // array, map value
+	struct Type *keytype; // map
 	struct Type *next;
 } Type;
 
@@ -128,9 +164,14 @@ typedef struct {
 		struct Stmt *decl; // var
 		void *right; // binop
 		int64_t length; // string, array
+		void *args; // call
 	};
 
-	Token *op; // binop
+	union {
+		Token *op; // binop
+		Builtin builtin; // call
+		int64_t literal_id; // string
+	};
 } Expr;
 
 typedef struct Stmt {
@@ -158,7 +199,10 @@ typedef struct Stmt {
 		void *else_body; // if
 	};
 
-	void *next_decl; // vardecl, funcdecl
+	union {
+		void *next_decl; // vardecl, funcdecl
+		Token *else_start; // if
+	};
 } Stmt;
 
 typedef struct Block {
@@ -172,6 +216,8 @@ typedef struct Block {
 	Temp *last_temp;
 	Type *types;
 	Type *last_type;
+	Expr **literals;
+	int64_t num_literals;
 } Block;
 
 typedef void (*EscapeMod)(va_list);
@@ -209,4 +255,4 @@ Block *parse(Token *tokens);
 void analyse(Block *block);
 
 // generate
-void generate(Block *block, char *output_file);
\ No newline at end of file
+void generate(Block *block, char *input_file, char *output_file, int64_t alloc_sites, int64_t inline_runtime);
\ No newline at end of file
@@ -1,41 +1,144 @@
 #include "crunchy.h"
 
+// runtime_inline.h compiles the runtime into the generated program, there the hot paths become static inline
+#ifdef CRUNCHY_INLINE_RUNTIME
+#define RUNTIME_INLINE static inline
+#else
+#define RUNTIME_INLINE
+#endif
+
 typedef struct {
-	void *next;
-	Type *type;
-	uint8_t marked;
+	uint32_t type;
+	uint32_t flags;
 } MemoryBlock;
 
+// string literals are static objects with this flag, the collector never marks, moves or frees them
+#define GC_STATIC 16
+#define STRING_TYPE_ID 1
+#define STATIC_STRING(length, chars) {{STRING_TYPE_ID, GC_STATIC}, length, chars}
+
 typedef struct {
 	MemoryBlock block;
 	int64_t length;
-	char chars[];
+	char *chars;
 } String;
 
 typedef struct {
 	MemoryBlock block;
 	int64_t length;
+	int64_t capacity;
 	void *items;
 } Array;
 
+typedef struct {
+	MemoryBlock block;
+	int64_t length;
+	int64_t capacity;
+	int64_t deleted;
+	uint8_t *ctrl;
+} Map;
+
+typedef struct {
+	char *name;
+	char *file;
+	int64_t line;
+} FrameInfo;
+
 typedef struct {
 	void *parent;
 	int64_t num_gc_decls;
+	int64_t remembered;
+	FrameInfo *info;
 	MemoryBlock *gc_objs[];
 } Frame;
 
 typedef void (*Function)(void);
 
+typedef struct {
+	char *file;
+	int64_t line;
+	char *kind;
+} AllocSite;
+
+typedef struct {
+	int64_t minor_collections;
+	int64_t major_collections;
+	int64_t pause_ns;
+	int64_t max_pause_ns;
+	int64_t frames_scanned;
+	int64_t promoted_objects;
+	int64_t promoted_bytes;
+	int64_t marked_objects;
+	int64_t marked_bytes;
+	int64_t swept_objects;
+	int64_t swept_bytes;
+	int64_t compactions;
+	int64_t emergency_collections;
+	int64_t moved_objects;
+	int64_t moved_bytes;
+	int64_t strings;
+	int64_t string_bytes;
+	int64_t arrays;
+	int64_t array_bytes;
+	int64_t concats;
+	int64_t concat_bytes;
+	int64_t views;
+	int64_t view_bytes;
+	int64_t heap_bytes;
+	int64_t peak_heap_bytes;
+} GcStats;
+
 extern Type t_int;
 extern Type t_bool;
 extern Type t_string;
 extern Type t_func;
 
-void push_frame(void *frame);
-void pop_frame();
-void *get_cur_frame();
-String *new_string(int64_t length, char *chars);
-Array *new_array(Type *type, int64_t length, void *data);
+void attach_thread();
+void detach_thread();
+RUNTIME_INLINE void push_frame(void *frame);
+RUNTIME_INLINE void pop_frame();
+RUNTIME_INLINE void *get_cur_frame();
+RUNTIME_INLINE String *new_string(int64_t length, char *chars);
+Array *new_array(Type *type, int64_t length, ...);
+void array_push(Array *array, ...);
+void print_chars(char *chars, int64_t length);
+void print_int(int64_t value);
+void print_bool(int64_t value);
+void print_newline();
 void print_string(String *str);
 void print_array(Array *array, Type *type);
-String *concat_strings(String *left, String *right);
\ No newline at end of file
+void flush_output();
+String *concat_strings(String *left, String *right);
+String *concat_many(int64_t count, ...);
+String *slice_string(String *string, int64_t start, int64_t end);
+Array *slice_array(Array *array, int64_t start, int64_t end);
+int64_t array_sum(Array *array);
+int64_t array_min(Array *array);
+int64_t array_max(Array *array);
+int64_t array_count(Array *array, int64_t value);
+int64_t array_find(Array *array, int64_t value);
+void array_fill(Array *array, int64_t value);
+void array_copy(Array *dest, Array *source);
+Map *new_map(Type *type);
+void map_set(Map *map, ...);
+int64_t map_get(Map *map, ...);
+int64_t map_has(Map *map, ...);
+void map_delete(Map *map, ...);
+void print_map(Map *map, Type *type);
+String *read_file(String *path);
+String *read_line();
+int64_t input_eof();
+Array *split_lines(String *string, Type *type);
+int64_t parse_int(String *string);
+void spawn_task(Function function);
+void wait_tasks();
+
+void register_alloc_sites(AllocSite *sites);
+RUNTIME_INLINE String *new_string_at(int64_t site, int64_t length, char *chars);
+Array *new_array_at(int64_t site, Type *type, int64_t length, ...);
+String *concat_strings_at(int64_t site, String *left, String *right);
+String *concat_many_at(int64_t site, int64_t count, ...);
+
+void collect_garbage();
+void get_gc_stats(GcStats *stats);
+void write_gc_stats(FILE *fs);
\ No newline at end of file
@@ -0,0 +1,3 @@
+// single header runtime: the generated program and the runtime become one translation unit
+#define CRUNCHY_INLINE_RUNTIME
+#include "../src/runtime.c"
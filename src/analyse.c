@@ -51,13 +51,17 @@ void record_type(Type *type)
 {
 	assert(type);
 
-	if(type->kind != TY_ARRAY) return;
+	if(type->kind != TY_ARRAY && type->kind != TY_MAP) return;
+
+	for(Type *t = type; t->kind == TY_ARRAY || t->kind == TY_MAP; t = t->subtype) {
+		if(t->subtype->kind == TY_UNKNOWN) return;
+	}
 
 	for(Type *t = global_block->types; t; t = t->next) {
 		if(types_equal(t, type)) return;
 	}
 
-	if(type->kind == TY_ARRAY) record_type(type->subtype);
+	if(type->kind == TY_ARRAY || type->kind == TY_MAP) record_type(type->subtype);
 
 	assert(type->next == 0);
 
@@ -71,12 +75,172 @@ void record_type(Type *type)
 	global_block->last_type = type;
 }
 
+void record_literal(Expr *string)
+{
+	for(int64_t i=0; i < global_block->num_literals; i++) {
+		Expr *literal = global_block->literals[i];
+
+		if(literal->length == string->length && memcmp(literal->chars, string->chars, string->length) == 0) {
+			string->literal_id = i + 1;
+			return;
+		}
+	}
+
+	global_block->literals = realloc(global_block->literals, sizeof(Expr*) * (global_block->num_literals + 1));
+	global_block->literals[global_block->num_literals ++] = string;
+	string->literal_id = global_block->num_literals;
+}
+
+Builtin find_builtin(Token *ident)
+{
+	#define _(a) \
+	if(ident->length == strlen(#a) && memcmp(ident->start, #a, ident->length) == 0) return BI_ ## a;
+	BUILTINS
+	#undef _
+
+	return BI_NONE;
+}
+
+void check_flat_array(Expr *array, Token *builtin)
+{
+	Type *type = array->type;
+
+	if(type->kind != TY_ARRAY || (type->subtype->kind != TY_INT && type->subtype->kind != TY_BOOL))
+		error_at(array->start, "%n expects an int or bool array", builtin);
+}
+
+int a_builtin(Expr *call)
+{
+	Expr *callee = call->callee;
+	if(callee->kind != EX_VAR || lookup(callee->ident)) return 0;
+	call->builtin = find_builtin(callee->ident);
+	if(!call->builtin) return 0;
+	int64_t num_args = 0;
+
+	for(Expr *arg = call->args; arg; arg = arg->next) {
+		a_expr(arg);
+		num_args ++;
+	}
+
+	switch(call->builtin) {
+		case BI_push: {
+			if(num_args != 2) error_at(call->start, "push expects an array and a value");
+			Expr *array = call->args;
+			if(array->type->kind != TY_ARRAY) error_at(array->start, "can only push to an array");
+			array->next = adjust_expr_to_type(array->next, array->type->subtype);
+			call->type = new_type(TY_VOID);
+		} break;
+		case BI_slice: {
+			if(num_args != 3) error_at(call->start, "slice expects a string or array, a start and an end");
+			Expr *source = call->args;
+
+			if(source->type->kind != TY_STRING && source->type->kind != TY_ARRAY)
+				error_at(source->start, "can only slice a string or an array");
+
+			Expr *start = source->next;
+			Expr *end = start->next;
+			start = source->next = adjust_expr_to_type(start, new_type(TY_INT));
+			start->next = adjust_expr_to_type(end, new_type(TY_INT));
+			call->type = source->type;
+			make_temp(call);
+		} break;
+		case BI_spawn: {
+			if(num_args != 1) error_at(call->start, "spawn expects a function");
+			Expr *function = call->args;
+			if(function->type->kind != TY_FUNC) error_at(function->start, "can only spawn a function");
+			call->type = new_type(TY_VOID);
+		} break;
+		case BI_wait:
+			if(num_args != 0) error_at(call->start, "wait takes no arguments");
+			call->type = new_type(TY_VOID);
+			break;
+		case BI_sum:
+		case BI_min:
+		case BI_max: {
+			if(num_args != 1) error_at(call->start, "%n expects an int or bool array", callee->ident);
+			Expr *array = call->args;
+			check_flat_array(array, callee->ident);
+			call->type = call->builtin == BI_sum ? new_type(TY_INT) : array->type->subtype;
+		} break;
+		case BI_count:
+		case BI_find:
+		case BI_fill: {
+			if(num_args != 2) error_at(call->start, "%n expects an int or bool array and a value", callee->ident);
+			Expr *array = call->args;
+			check_flat_array(array, callee->ident);
+			array->next = adjust_expr_to_type(array->next, array->type->subtype);
+			call->type = new_type(call->builtin == BI_fill ? TY_VOID : TY_INT);
+		} break;
+		case BI_copy: {
+			if(num_args != 2) error_at(call->start, "copy expects a destination and a source array");
+			Expr *dest = call->args;
+			Expr *source = dest->next;
+			check_flat_array(dest, callee->ident);
+			check_flat_array(source, callee->ident);
+			if(!types_equal(dest->type, source->type)) error_at(source->start, "copy expects arrays of the same type");
+			call->type = new_type(TY_VOID);
+		} break;
+		case BI_get:
+		case BI_has:
+		case BI_delete: {
+			if(num_args != 2) error_at(call->start, "%n expects a map and a key", callee->ident);
+			Expr *map = call->args;
+			if(map->type->kind != TY_MAP) error_at(map->start, "%n expects a map", callee->ident);
+			map->next = adjust_expr_to_type(map->next, map->type->keytype);
+			call->type = call->builtin == BI_get ? map->type->subtype : new_type(call->builtin == BI_has ? TY_BOOL : TY_VOID);
+			if(is_gc_type(call->type)) make_temp(call);
+		} break;
+		case BI_set: {
+			if(num_args != 3) error_at(call->start, "set expects a map, a key and a value");
+			Expr *map = call->args;
+			if(map->type->kind != TY_MAP) error_at(map->start, "set expects a map");
+			Expr *key = map->next;
+			Expr *value = key->next;
+			key = map->next = adjust_expr_to_type(key, map->type->keytype);
+			key->next = adjust_expr_to_type(value, map->type->subtype);
+			call->type = new_type(TY_VOID);
+		} break;
+		case BI_readfile:
+		case BI_lines:
+		case BI_parseint: {
+			if(num_args != 1) error_at(call->start, "%n expects a string", callee->ident);
+			Expr *string = call->args;
+			if(string->type->kind != TY_STRING) error_at(string->start, "%n expects a string", callee->ident);
+
+			if(call->builtin == BI_parseint) {
+				call->type = new_type(TY_INT);
+			}
+			else if(call->builtin == BI_lines) {
+				call->type = new_type(TY_ARRAY);
+				call->type->subtype = new_type(TY_STRING);
+				record_type(call->type);
+			}
+			else {
+				call->type = string->type;
+			}
+
+			if(is_gc_type(call->type)) make_temp(call);
+		} break;
+		case BI_readline:
+		case BI_eof:
+			if(num_args != 0) error_at(call->start, "%n takes no arguments", callee->ident);
+			call->type = new_type(call->builtin == BI_eof ? TY_BOOL : TY_STRING);
+			if(is_gc_type(call->type)) make_temp(call);
+			break;
+	}
+
+	return 1;
+}
+
 void a_binop(Expr *binop)
 {
 	Expr *left = binop->left;
 	Expr *right = binop->right;
-	a_expr(left);
-	a_expr(right);
+	// nested binops get no temp, a chain of string concatenations is generated as one call
+	if(left->kind == EX_BINOP) a_binop(left);
+	else a_expr(left);
+	if(right->kind == EX_BINOP) a_binop(right);
+	else a_expr(right);
 	Type *ltype = left->type;
 	Type *rtype = right->type;
 
@@ -101,7 +265,7 @@ void a_expr(Expr *expr)
 			break;
 		case EX_STRING:
 			expr->type = new_type(TY_STRING);
-			make_temp(expr);
+			record_literal(expr);
 			break;
 		case EX_VAR:
 			expr->decl = lookup(expr->ident);
@@ -114,7 +278,9 @@ void a_expr(Expr *expr)
 			if(expr->type->kind == TY_STRING) make_temp(expr);
 			break;
 		case EX_CALL:
+			if(a_builtin(expr)) break;
 			a_expr(expr->callee);
+			if(expr->args) error_at(expr->start, "functions do not take arguments");
 			expr->type = new_type(TY_VOID);
 			break;
 
@@ -147,7 +313,7 @@ void validate_vardecl_type(Stmt *vardecl, Type *type)
 	if(type->kind == TY_UNKNOWN)
 		error_at(vardecl->start, "type is incomplete");
 
-	if(type->kind == TY_ARRAY)
+	if(type->kind == TY_ARRAY || type->kind == TY_MAP)
 		validate_vardecl_type(vardecl, type->subtype);
 }
 
@@ -167,14 +333,18 @@ void a_stmt(Stmt *stmt)
 			}
 			else if(stmt->type) {
 				stmt->init = get_default_value(stmt->type);
+				stmt->init->start = stmt->start;
+				if(stmt->init->kind == EX_STRING) record_literal(stmt->init);
 			}
 
 			if(!stmt->type)
 				error_at(stmt->start, "could not find out the type for this variable declaration");
 
-			if(stmt->type->kind == TY_STRING || stmt->type->kind == TY_ARRAY)
+			if(is_gc_type(stmt->type))
 				cur_block->num_gc_decls ++;
 
+			record_type(stmt->type);
+
 			validate_vardecl_type(stmt, stmt->type);
 			break;
 		case ST_FUNCDECL:
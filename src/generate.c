@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include "crunchy.h"
 
@@ -11,9 +12,14 @@ char runtime_src[] = {
 
 FILE *ofs = 0;
 static int level = 0;
+static int64_t alloc_sites = 0;
+static char *source_file = 0;
+static Expr **sites = 0;
+static int64_t site_count = 0;
+static int64_t spawns = 0;
 
 void gen_expr(Expr *expr);
-void gen_block(Block *block);
+void gen_block(Block *block, Stmt *owner);
 void gen_print(Expr *value);
 void gen_type_desc_name(Type *type);
 
@@ -48,6 +54,9 @@ void gen_type(Type *type)
 		case TY_ARRAY:
 			print("Array*");
 			break;
+		case TY_MAP:
+			print("Map*");
+			break;
 		default:
 			print("/* INTERNAL: unknown type to generate */");
 	}
@@ -67,6 +76,121 @@ void gen_cast(Type *type, Expr *expr)
 	}
 }
 
+void gen_alloc_call(char *name, Expr *expr)
+{
+	if(!alloc_sites) {
+		print("%s(", name);
+		return;
+	}
+
+	sites = realloc(sites, sizeof(Expr*) * (site_count + 1));
+	sites[site_count ++] = expr;
+	print("%s_at(%iL, ", name, site_count);
+}
+
+void gen_alloc_sites(char *input_file)
+{
+	print("AllocSite alloc_sites[] = {%+\n");
+
+	for(int64_t i=0; i < site_count; i++) {
+		Expr *expr = sites[i];
+		print(
+			"%>{\"%s\", %iL, \"%s\"},\n", input_file, expr->start->line,
+			expr->kind == EX_ARRAY ? "array" : "concat"
+		);
+	}
+
+	print("%>{0},\n");
+	print("%-};\n");
+}
+
+int64_t count_concat(Expr *expr)
+{
+	if(expr->kind != EX_BINOP || expr->type->kind != TY_STRING) return 1;
+	return count_concat(expr->left) + count_concat(expr->right);
+}
+
+void gen_concat_args(Expr *expr)
+{
+	if(expr->kind != EX_BINOP || expr->type->kind != TY_STRING) {
+		print(", %n", expr);
+		return;
+	}
+
+	gen_concat_args(expr->left);
+	gen_concat_args(expr->right);
+}
+
+void gen_builtin(Expr *call)
+{
+	Expr *callee = call->callee;
+	Expr *args = call->args;
+
+	switch(call->builtin) {
+		case BI_push:
+			print("array_push(%n, (%n)(%n))", args, args->type->subtype, args->next);
+			break;
+		case BI_slice: {
+			Expr *start = args->next;
+			print(
+				"slice_%s(%n, %n, %n)", args->type->kind == TY_STRING ? "string" : "array",
+				args, start, start->next
+			);
+		} break;
+		case BI_spawn:
+			spawns = 1;
+			print("spawn_task(%n)", args);
+			break;
+		case BI_wait:
+			print("wait_tasks()");
+			break;
+		case BI_sum:
+		case BI_min:
+		case BI_max:
+			print("array_%n(%n)", callee->ident, args);
+			break;
+		case BI_count:
+		case BI_find:
+		case BI_fill:
+		case BI_copy:
+			print("array_%n(%n, %n)", callee->ident, args, args->next);
+			break;
+		case BI_get:
+			print("((%n)map_get(%n, (%n)(%n)))", call->type, args, args->type->keytype, args->next);
+			break;
+		case BI_has:
+		case BI_delete:
+			print("map_%n(%n, (%n)(%n))", callee->ident, args, args->type->keytype, args->next);
+			break;
+		case BI_set: {
+			Expr *key = args->next;
+			print(
+				"map_set(%n, (%n)(%n), (%n)(%n))",
+				args, args->type->keytype, key, args->type->subtype, key->next
+			);
+		} break;
+		case BI_readfile:
+			print("read_file(%n)", args);
+			break;
+		case BI_parseint:
+			print("parse_int(%n)", args);
+			break;
+		case BI_readline:
+			print("read_line()");
+			break;
+		case BI_eof:
+			print("input_eof()");
+			break;
+		case BI_lines:
+			print("split_lines(%n, &", args);
+			gen_type_desc_name(call->type);
+			print(")");
+			break;
+		default:
+			print("/* INTERNAL: unknown builtin to generate */");
+	}
+}
+
 void gen_expr(Expr *expr)
 {
 	if(expr->temp) {
@@ -84,16 +208,7 @@ void gen_expr(Expr *expr)
 			print("%i", expr->ival);
 			break;
 		case EX_STRING:
-			print("new_string(%iL, \"", expr->length);
-
-			for(int64_t i=0; i < expr->length; i++) {
-				if(expr->chars[i] == '"')
-					print("\\\"");
-				else
-					print("%c", expr->chars[i]);
-			}
-
-			print("\")");
+			print("(&literal%i)", expr->literal_id);
 			break;
 		case EX_VAR:
 			gen_full_name(expr->decl);
@@ -102,25 +217,44 @@ void gen_expr(Expr *expr)
 			gen_cast(expr->type, expr->subexpr);
 			break;
 		case EX_BINOP:
-			if(expr->type->kind == TY_STRING)
-				print("concat_strings(%n, %n)", expr->left, expr->right);
-			else
+			if(expr->type->kind == TY_STRING && count_concat(expr) == 2) {
+				gen_alloc_call("concat_strings", expr);
+				print("%n, %n)", expr->left, expr->right);
+			}
+			else if(expr->type->kind == TY_STRING) {
+				gen_alloc_call("concat_many", expr);
+				print("%iL", count_concat(expr));
+				gen_concat_args(expr);
+				print(")");
+			}
+			else {
 				print("(%n%n%n)", expr->left, expr->op, expr->right);
+			}
 
 			break;
 		case EX_CALL:
-			print("%n()", expr->callee);
+			if(expr->builtin)
+				gen_builtin(expr);
+			else
+				print("%n()", expr->callee);
+
 			break;
 		case EX_ARRAY:
-			print("new_array(&");
+			gen_alloc_call("new_array", expr);
+			print("&");
 			gen_type_desc_name(expr->type);
-			print(", %i, &(%n[]){", expr->length, expr->type->subtype);
+			print(", %iL", expr->length);
 
 			for(Expr *item = expr->items; item; item = item->next) {
-				print("%n, ", item);
+				print(", (%n)(%n)", expr->type->subtype, item);
 			}
 
-			print("})");
+			print(")");
+			break;
+		case EX_MAP:
+			print("new_map(&");
+			gen_type_desc_name(expr->type);
+			print(")");
 			break;
 		default:
 			print("/* INTERNAL: unknown expression to generate */");
@@ -134,14 +268,14 @@ void gen_expr(Expr *expr)
 void gen_print_array(Expr *value)
 {
 	if(value->kind == EX_ARRAY) {
-		print("%>printf(\"[\");\n");
+		print("%>print_chars(\"[\", 1);\n");
 
 		for(Expr *item = value->items; item; item = item->next) {
-			if(item != value->items) print("%>printf(\", \");\n");
+			if(item != value->items) print("%>print_chars(\", \", 2);\n");
 			gen_print(item);
 		}
 
-		print("%>printf(\"]\");\n");
+		print("%>print_chars(\"]\", 1);\n");
 	}
 	else {
 		print("%>print_array(%n, &", value);
@@ -150,14 +284,21 @@ void gen_print_array(Expr *value)
 	}
 }
 
+void gen_print_map(Expr *value)
+{
+	print("%>print_map(%n, &", value);
+	gen_type_desc_name(value->type);
+	print(");\n");
+}
+
 void gen_print(Expr *value)
 {
 	switch(value->type->kind) {
 		case TY_INT:
-			print("%>printf(\"%%li\", ");
+			print("%>print_int(");
 			break;
 		case TY_BOOL:
-			print("%>printf(\"%%s\", ");
+			print("%>print_bool(");
 			break;
 		case TY_STRING:
 			print("%>print_string(");
@@ -165,21 +306,32 @@ void gen_print(Expr *value)
 		case TY_ARRAY:
 			gen_print_array(value);
 			return;
+		case TY_MAP:
+			gen_print_map(value);
+			return;
 		default:
 			print("%>// INTERNAL: unknown value type to generate print for\n");
 			return;
 	}
 
-	if(value->type->kind == TY_BOOL)
-		print("%n ? \"true\" : \"false\");\n", value);
-	else
-		print("%n);\n", value);
+	print("%n);\n", value);
 }
 
 void gen_print_line(Expr *value)
 {
 	gen_print(value);
-	print("%>printf(\"\\n\");\n");
+	print("%>print_newline();\n");
+}
+
+void gen_write_barrier(Stmt *assign)
+{
+	Expr *target = assign->target;
+	if(target->kind != EX_VAR || !is_gc_type(target->type)) return;
+	Block *target_block = target->decl->parent_block;
+
+	if(target_block != assign->parent_block) {
+		print("%>frame%i.remembered = 1;\n", target_block->id);
+	}
 }
 
 void gen_stmt(Stmt *stmt)
@@ -194,6 +346,7 @@ void gen_stmt(Stmt *stmt)
 			break;
 		case ST_ASSIGN:
 			print("%>%n = %n;\n", stmt->target, stmt->value);
+			gen_write_barrier(stmt);
 			break;
 		case ST_CALL:
 			print("%>%n;\n", stmt->call);
@@ -203,12 +356,12 @@ void gen_stmt(Stmt *stmt)
 			break;
 		case ST_IF:
 			print("%>if(%n) {%+\n", stmt->cond);
-			gen_block(stmt->body);
+			gen_block(stmt->body, stmt);
 			print("%-%>}\n");
 
 			if(stmt->else_body) {
 				print("%>else {%+\n");
-				gen_block(stmt->else_body);
+				gen_block(stmt->else_body, stmt);
 				print("%-%>}\n");
 			}
 
@@ -228,10 +381,16 @@ void gen_type_desc_data(Type *type)
 		case TY_STRING: print("STRING"); break;
 		case TY_FUNC: print("FUNC"); break;
 		case TY_ARRAY: print("ARRAY"); break;
+		case TY_MAP: print("MAP"); break;
 		default: print("/* invalid type to generate type desc for */");
 	}
 
-	if(type->kind == TY_ARRAY) {
+	if(type->kind == TY_MAP) {
+		print(", .keytype = &");
+		gen_type_desc_name(type->keytype);
+	}
+
+	if(type->kind == TY_ARRAY || type->kind == TY_MAP) {
 		print(", .subtype = &");
 		gen_type_desc_name(type->subtype);
 	}
@@ -244,8 +403,17 @@ void gen_type_desc_name(Type *type)
 	print("t_");
 
 	for(Type *type_node = type; type_node; type_node = type_node->subtype) {
-		if(type_node->kind == TY_ARRAY) print("array_");
-		else print_type(type_node);
+		if(type_node->kind == TY_ARRAY) {
+			print("array_");
+		}
+		else if(type_node->kind == TY_MAP) {
+			print("map_");
+			print_type(type_node->keytype);
+			print("_");
+		}
+		else {
+			print_type(type_node);
+		}
 	}
 }
 
@@ -258,20 +426,57 @@ void gen_type_desc(Type *type)
 	print(";\n");
 }
 
-void gen_decls(Block *block)
+void gen_literal(Expr *string)
+{
+	print("%>static String literal%i = STATIC_STRING(%iL, \"", string->literal_id, string->length);
+
+	for(int64_t i=0; i < string->length; i++) {
+		if(string->chars[i] == '"')
+			print("\\\"");
+		else
+			print("%c", string->chars[i]);
+	}
+
+	print("\");\n");
+}
+
+void gen_frame_info(Block *block, Stmt *owner)
+{
+	print("%>static FrameInfo frame_info%i = {\"", block->id);
+
+	if(!owner)
+		print("main");
+	else if(owner->kind == ST_FUNCDECL)
+		print("%n", owner->ident);
+	else
+		print("%s", block == owner->else_body ? "else" : "if");
+
+	Token *start = 0;
+	if(owner) start = block == owner->else_body ? owner->else_start : owner->start;
+	print("\", \"%s\", %iL};\n", source_file, start ? start->line : 1);
+}
+
+void gen_decls(Block *block, Stmt *owner)
 {
 	for(Type *type = block->types; type; type = type->next) {
 		gen_type_desc(type);
 	}
 
+	for(int64_t i=0; i < block->num_literals; i++) {
+		gen_literal(block->literals[i]);
+	}
+
 	for(Stmt *decl = block->decls; decl; decl = decl->next_decl) {
 		if(decl->kind == ST_FUNCDECL)
 			print("%>void v_%n();\n", decl->ident);
 	}
 
+	gen_frame_info(block, owner);
 	print("%>struct {%+\n");
 	print("%>void *parent;\n");
 	print("%>int64_t num_gc_decls;\n");
+	print("%>int64_t remembered;\n");
+	print("%>FrameInfo *info;\n");
 
 	for(Temp *temp = block->temps; temp; temp = temp->next) {
 		print("%>%n temp%i;\n", temp->type, temp->id);
@@ -288,24 +493,25 @@ void gen_decls(Block *block)
 	}
 
 	print(
-		"%-%>} frame%i = {.parent = %s, .num_gc_decls = %iL};\n",
-		block->id, block->parent ? "get_cur_frame()" : "0", block->num_gc_decls
+		"%-%>} frame%i = {.parent = %s, .num_gc_decls = %iL, .info = &frame_info%i};\n",
+		block->id, block->parent ? "get_cur_frame()" : "0", block->num_gc_decls, block->id
 	);
 
 	for(Stmt *decl = block->decls; decl; decl = decl->next_decl) {
 		if(decl->kind == ST_FUNCDECL) {
 			print("void v_%n() {%+\n", decl->ident);
-			gen_block(decl->body);
+			gen_block(decl->body, decl);
 			print("%-}\n");
 		}
 	}
 }
 
-void gen_block(Block *block)
+void gen_block(Block *block, Stmt *owner)
 {
-	if(block->parent) gen_decls(block);
+	if(block->parent) gen_decls(block, owner);
 	print("%>push_frame(&frame%i);\n", block->id);
 	for(Stmt *stmt = block->stmts; stmt; stmt = stmt->next) gen_stmt(stmt);
+	if(!owner && spawns) print("%>wait_tasks();\n");
 	print("%>pop_frame();\n");
 }
 
@@ -324,7 +530,7 @@ void mod_gen_node(va_list args)
 		gen_token(node);
 }
 
-void generate(Block *block, char *output_file)
+void generate(Block *block, char *input_file, char *output_file, int64_t with_alloc_sites, int64_t inline_runtime)
 {
 	Stmt *stmts = block->stmts;
 	ofs = fopen(output_file, "wb");
@@ -333,12 +539,17 @@ void generate(Block *block, char *output_file)
 
 	//print("%s\n\n", runtime_src);
 	//print("#include \"src/runtime.c\"\n");
-	print("#include \"runtime.h\"\n");
-	gen_decls(block);
+	alloc_sites = with_alloc_sites;
+	source_file = input_file;
+	print("#include \"%s\"\n", inline_runtime ? "runtime_inline.h" : "runtime.h");
+	if(alloc_sites) print("extern AllocSite alloc_sites[];\n");
+	gen_decls(block, 0);
 	print("int main(int argc, char **argv) {%+\n");
-	gen_block(block);
+	if(alloc_sites) print("%>register_alloc_sites(alloc_sites);\n");
+	gen_block(block, 0);
 	print("%>return 0;\n");
 	print("%-}\n");
+	if(alloc_sites) gen_alloc_sites(input_file);
 
 	set_print_file(stdout);
 	set_escape_mod('n', 0);
@@ -80,11 +80,7 @@ char *load_text_file(char *file_name)
 
 Type *new_type(Kind kind)
 {
-	if(kind == TY_UNKNOWN) {
-		static Type unknown_type = {.kind = TY_UNKNOWN};
-		return &unknown_type;
-	}
-	else if(kind == TY_INT) {
+	if(kind == TY_INT) {
 		static Type int_type = {.kind = TY_INT};
 		return &int_type;
 	}
@@ -189,6 +185,10 @@ Expr *get_default_value(Type *type)
 			expr = new_expr(EX_ARRAY, 0, 0);
 			expr->type = type;
 			break;
+		case TY_MAP:
+			expr = new_expr(EX_MAP, 0, 0);
+			expr->type = type;
+			break;
 		default:
 			error("INTERNAL: unknown type to get default value for");
 	}
@@ -202,12 +202,14 @@ int types_equal(Type *a, Type *b)
 		return 1;
 	if(a->kind == TY_ARRAY && b->kind == TY_ARRAY)
 		return types_equal(a->subtype, b->subtype);
+	if(a->kind == TY_MAP && b->kind == TY_MAP)
+		return types_equal(a->keytype, b->keytype) && types_equal(a->subtype, b->subtype);
 	return a->kind == b->kind;
 }
 
 int is_gc_type(Type *type)
 {
-	return type->kind == TY_STRING || type->kind == TY_ARRAY;
+	return type->kind == TY_STRING || type->kind == TY_ARRAY || type->kind == TY_MAP;
 }
 
 Expr *adjust_expr_to_type(Expr *expr, Type *type)
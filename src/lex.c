@@ -71,6 +71,11 @@ int64_t lex(char *src, Token **tokens_out)
 			emit_token(TK_STRING, .str_length = str_length);
 		}
 
+		else if(src[0] == '=' && src[1] == '>') {
+			src += 2;
+			emit_token(PT_ARROW);
+		}
+
 		#define _(a, b) else if(*src == a) { src ++; emit_token(PT_ ## b); }
 		PUNCTS
 		#undef _
@@ -4,11 +4,20 @@
 
 int main(int argc, char **argv)
 {
-	if(argc < 2) {
+	char *input_file = 0;
+	int64_t alloc_sites = 0;
+	int64_t inline_runtime = 0;
+
+	for(int i=1; i < argc; i++) {
+		if(strcmp(argv[i], "--alloc-sites") == 0) alloc_sites = 1;
+		else if(strcmp(argv[i], "--inline-runtime") == 0) inline_runtime = 1;
+		else input_file = argv[i];
+	}
+
+	if(!input_file) {
 		error("missing input file parameter");
 	}
 
-	char *input_file = argv[1];
 	char *src = load_text_file(input_file);
 	// print("\n%[ff0]# SOURCE%[]\n");
 	// print("%s\n", src);
@@ -32,7 +41,7 @@ int main(int argc, char **argv)
 	memcpy(output_file + input_filename_length, ".c", 2);
 	output_file[input_filename_length + 2] = 0;
 
-	generate(block, output_file);
+	generate(block, input_file, output_file, alloc_sites, inline_runtime);
 
 	print("\n%[ff0]# DONE %[]\n");
 	return 0;
@@ -56,6 +56,17 @@ Type *p_type()
 		type = array_type;
 	}
 
+	if(eat(PT_ARROW)) {
+		if(type->kind != TY_INT && type->kind != TY_BOOL && type->kind != TY_STRING)
+			error("map keys must be int, bool or string");
+
+		Type *map_type = new_type(TY_MAP);
+		map_type->keytype = type;
+		map_type->subtype = p_type();
+		if(!map_type->subtype) error("missing value type after =>");
+		type = map_type;
+	}
+
 	return type;
 }
 
@@ -123,9 +134,22 @@ Expr *p_call()
 	if(!callee) return 0;
 
 	while(eat(PT_LPAREN)) {
-		expect(PT_RPAREN, "expected ) after (");
+		Expr *first_arg = 0;
+		Expr *last_arg = 0;
+
+		while(1) {
+			Expr *arg = p_expr();
+			if(!arg) break;
+			if(last_arg) last_arg->next = arg;
+			else first_arg = arg;
+			last_arg = arg;
+			if(!eat(PT_COMMA)) break;
+		}
+
+		expect(PT_RPAREN, "expected ) or , after call argument");
 		Expr *call = new_expr(EX_CALL, callee->start, 0);
 		call->callee = callee;
+		call->args = first_arg;
 		callee = call;
 	}
 
@@ -227,6 +251,7 @@ Stmt *p_if()
 	Block *body = p_block();
 	expect(PT_RCURLY, "expected '}' after if-body");
 	Block *else_body = 0;
+	Token *else_start = cur_token;
 
 	if(eat(KW_else)) {
 		expect(PT_LCURLY, "expected '{' after else keyword");
@@ -238,6 +263,7 @@ Stmt *p_if()
 	stmt->cond = cond;
 	stmt->body = body;
 	stmt->else_body = else_body;
+	stmt->else_start = else_start;
 	return stmt;
 }
 
@@ -141,6 +141,7 @@ void print_token_list(Token *tokens)
 			PUNCTS
 			#undef _
 
+			token->kind == PT_ARROW ? "<PUNCT>   " :
 			"<unknown-token>"
 		);
 
@@ -165,6 +166,8 @@ int64_t print_type(Type *type)
 			return print("function");
 		case TY_ARRAY:
 			return print("%n[]", type->subtype);
+		case TY_MAP:
+			return print("%n => %n", type->keytype, type->subtype);
 		default:
 			return print("<unknown-type>");
 	}
@@ -203,8 +206,18 @@ int64_t print_expr(Expr *expr)
 			return print("%n(%n)", expr->type, expr->subexpr);
 		case EX_BINOP:
 			return print("(%n%n%n)", expr->left, expr->op, expr->right);
-		case EX_CALL:
-			return print("%n()", expr->callee);
+		case EX_CALL: {
+			int64_t printed_chars_count = 0;
+			printed_chars_count += print("%n(", expr->callee);
+
+			for(Expr *arg = expr->args; arg; arg = arg->next) {
+				if(arg != expr->args) printed_chars_count += print(", ");
+				printed_chars_count += print("%n", arg);
+			}
+
+			printed_chars_count += print(")");
+			return printed_chars_count;
+		} break;
 
 		case EX_ARRAY: {
 			int64_t printed_chars_count = 0;
@@ -219,6 +232,9 @@ int64_t print_expr(Expr *expr)
 			return printed_chars_count;
 		} break;
 
+		case EX_MAP:
+			return print("{}");
+
 		default:
 			return print("<unknown-expr:%i>", expr->kind);
 	}
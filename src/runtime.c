@@ -1,175 +1,3674 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 #include "runtime.h"
 
 static void noop(void){}
 
 Type t_int = {.kind = TY_INT};
 Type t_bool = {.kind = TY_BOOL};
-Type t_string = {.kind = TY_STRING};
+Type t_string = {.kind = TY_STRING, .id = STRING_TYPE_ID};
 Type t_func = {.kind = TY_FUNC};
 
-static MemoryBlock *memory_blocks = 0;
-static Frame *cur_frame = 0;
+#define GC_REMEMBERED 1
+#define GC_FORWARDED 2
+#define GC_LARGE 4
+#define GC_VIEW 8
+#define GC_SITE_SHIFT 16
+#define GC_SITE_MASK 0xffff0000
 
-void push_frame(void *frame)
+#define PAGE_SIZE (64 << 10)
+#define BITMAP_WORDS (PAGE_SIZE / 16 / 64)
+#define MAX_CELL_SIZE 2048
+#define ARENA_PAGES 16
+#define LARGE_MAP_MIN (64 << 10)
+#define HUGE_PAGE_SIZE (2 << 20)
+#define VIEW_MIN 16
+#define MAX_NURSERIES 256
+#define TASK_DEQUE_SIZE 4096
+#define MAX_TASK_DEPTH 64
+#define MAP_GROUP 16
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xfe
+
+#define OUT_BUFFER_SIZE (64 << 10)
+#define IN_BUFFER_SIZE (64 << 10)
+
+#define PROF_DEPTH 64
+#define PROF_STACKS 4096
+
+#define MARK_CHUNK 256
+#define PARALLEL_MARK_MIN (4 << 20)
+#define PARALLEL_KERNEL_MIN (1 << 20)
+#define EMERGENCY_COMPACT 50
+#define MAX_KERNEL_THREADS 64
+
+#define GC_IDLE 0
+#define GC_MARKING 1
+#define GC_SWEEPING 2
+
+typedef struct Page {
+	struct Page *next;
+	int64_t cell_size;
+	int64_t num_cells;
+	int64_t live_cells;
+	int64_t alloc_cursor;
+	int64_t swept_epoch;
+	char *cells;
+	uint64_t live_bits[BITMAP_WORDS];
+	uint64_t mark_bits[BITMAP_WORDS];
+} Page;
+
+typedef struct LargeObject {
+	struct LargeObject *next;
+	int64_t size;
+	int64_t marked;
+	int64_t mapped_size;
+	MemoryBlock block[];
+} LargeObject;
+
+typedef struct {
+	String string;
+	MemoryBlock *base;
+} StringView;
+
+typedef struct {
+	Array array;
+	MemoryBlock *base;
+} ArrayView;
+
+typedef struct {
+	int64_t key;
+	int64_t value;
+} MapSlot;
+
+typedef struct {
+	int64_t major;
+	int64_t start_ns;
+	int64_t pause_ns;
+	int64_t max_pause_ns;
+	int64_t pauses;
+	int64_t frames_scanned;
+	int64_t objects;
+	int64_t bytes;
+	int64_t swept_objects;
+	int64_t swept_bytes;
+	int64_t moved_objects;
+	int64_t moved_bytes;
+} GcRecord;
+
+typedef struct {
+	uint64_t hash;
+	int64_t count;
+	int64_t depth;
+	FrameInfo *frames[PROF_DEPTH];
+} ProfStack;
+
+typedef struct {
+	int64_t id;
+	int64_t allocs;
+	int64_t bytes;
+	int64_t live_bytes;
+	int64_t peak_live_bytes;
+} SiteStats;
+
+typedef struct {
+	MemoryBlock **items;
+	int64_t count;
+} MarkTask;
+
+typedef struct TaskBuffer {
+	struct TaskBuffer *retired;
+	int64_t mask;
+	MarkTask tasks[];
+} TaskBuffer;
+
+typedef struct {
+	int64_t top;
+	int64_t bottom;
+	TaskBuffer *buffer;
+	int64_t marked_objects;
+	int64_t marked_bytes;
+} MarkDeque;
+
+typedef struct {
+	int64_t cell_size;
+	Page *pages;
+	Page *alloc_page;
+	Page *full_pages;
+} Pool;
+
+typedef struct Task {
+	struct Task *next;
+	struct Task *parent;
+	Function function;
+	int64_t pending;
+} Task;
+
+typedef struct {
+	int64_t top;
+	int64_t bottom;
+	Task *tasks[TASK_DEQUE_SIZE];
+} TaskDeque;
+
+typedef struct Mutator {
+	struct Mutator *next;
+	Frame *cur_frame;
+	Frame *frame_watermark;
+	char *nursery;
+	char *nursery_top;
+	char *nursery_end;
+	MemoryBlock **remembered_set;
+	int64_t remembered_count;
+	int64_t remembered_capacity;
+	int64_t allocs_since_gc;
+	int64_t detached;
+	Task root_task;
+	Task *cur_task;
+	int64_t task_depth;
+	Frame *prof_anchor;
+	int64_t prof_anchor_depth;
+	FrameInfo *prof_outer[PROF_DEPTH - 1];
+	GcStats stats;
+	int64_t out_length;
+	char out_buffer[OUT_BUFFER_SIZE];
+} Mutator;
+
+typedef int64_t (*Kernel)(void *items, int64_t length, int64_t value);
+
+typedef struct {
+	Kernel sum_ints;
+	Kernel extreme_ints;
+	Kernel count_ints;
+	Kernel find_ints;
+	Kernel count_bytes;
+} Kernels;
+
+typedef struct {
+	Kernel kernel;
+	char *items;
+	int64_t length;
+	int64_t value;
+	int64_t result;
+} KernelChunk;
+
+static Pool pools[] = {
+	{16}, {32}, {48}, {64}, {96}, {128}, {192}, {256},
+	{384}, {512}, {768}, {1024}, {1536}, {MAX_CELL_SIZE},
+};
+
+static uint8_t pool_index[MAX_CELL_SIZE / 16 + 1];
+static Page *free_pages = 0;
+static Page *idle_pages = 0;
+static Page **released_pages = 0;
+static int64_t released_count = 0;
+static int64_t released_capacity = 0;
+static char *arena_next = 0;
+static char *arena_end = 0;
+static LargeObject *large_objects = 0;
+static LargeObject *unswept_large_objects = 0;
+static Type *initial_types[64] = {[STRING_TYPE_ID] = &t_string};
+static Type **type_table = initial_types;
+static uint32_t type_count = STRING_TYPE_ID;
+static uint32_t type_capacity = 64;
+static pthread_mutex_t type_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Mutator *mutators = 0;
+static __thread Mutator *mutator = 0;
+static int64_t active_mutators = 0;
+static int64_t parked_mutators = 0;
+static int64_t world_stopped = 0;
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t world_parked = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t world_resumed = PTHREAD_COND_INITIALIZER;
+
+static int64_t task_threads = 0;
+static int64_t workers_started = 0;
+static TaskDeque *task_deques = 0;
+static __thread TaskDeque *own_deque = 0;
+static Task *injected_tasks = 0;
+static Task *last_injected_task = 0;
+static int64_t injected_count = 0;
+static int64_t task_sleepers = 0;
+static pthread_mutex_t task_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t task_wake = PTHREAD_COND_INITIALIZER;
+
+static char *in_buffer = 0;
+static int64_t in_start = 0;
+static int64_t in_end = 0;
+static int64_t in_capacity = 0;
+static int64_t in_eof = 0;
+static pthread_mutex_t input_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int64_t gc_min_heap = 1 << 20;
+static double gc_growth = 2.0;
+static int64_t gc_every = 0;
+static int64_t gc_initialized = 0;
+static int64_t live_bytes = 0;
+static int64_t marked_objects = 0;
+static int64_t marked_bytes = 0;
+static int64_t allocated_bytes = 0;
+static int64_t heap_goal = 0;
+static int64_t minor_gc_pending = 0;
+static int64_t major_gc_pending = 0;
+
+static int64_t gc_incremental = 0;
+static int64_t gc_slice_objects = 1000;
+static int64_t gc_slice_us = 0;
+static int64_t gc_state = GC_IDLE;
+static int64_t gc_epoch = 0;
+static struct timespec slice_deadline;
+static Array *scan_array = 0;
+static int64_t scan_index = 0;
+static Pool *sweep_pool = 0;
+static Page **sweep_link = 0;
+
+static int64_t gc_huge_pages = 0;
+static int64_t gc_compact = 0;
+static int64_t gc_max_heap = 0;
+static int64_t gc_emergency = 0;
+static int64_t gc_view_copy = 8;
+static int64_t gc_threads = 1;
+static int64_t markers_started = 0;
+static int64_t markers_done = 0;
+static int64_t markers_idle = 0;
+static int64_t mark_round = 0;
+static MarkDeque *mark_deques = 0;
+static pthread_mutex_t marker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t marker_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t marker_finished = PTHREAD_COND_INITIALIZER;
+
+static GcStats gc_stats;
+static GcRecord minor_record;
+static GcRecord major_record;
+static GcRecord *gc_records = 0;
+static int64_t gc_record_count = 0;
+static int64_t gc_record_capacity = 0;
+static int64_t gc_start_ns = 0;
+static char *gc_stats_path = 0;
+static AllocSite *site_table = 0;
+static SiteStats *site_stats = 0;
+static int64_t site_count = 0;
+static int64_t site_censuses = 0;
+static char *site_report_path = 0;
+static int64_t out_line_flush = 0;
+static int64_t kernel_threads = 1;
+static ProfStack *prof_stacks = 0;
+static int64_t prof_lock = 0;
+static int64_t prof_dropped = 0;
+static FrameInfo prof_truncated = {"[truncated]"};
+static char *prof_path = 0;
+
+static char *young_space = 0;
+static char *young_space_end = 0;
+static int64_t nursery_size = 512 << 10;
+static uint8_t nursery_used[MAX_NURSERIES];
+
+static MemoryBlock **mark_stack = 0;
+static int64_t mark_stack_count = 0;
+static int64_t mark_stack_capacity = 0;
+static MemoryBlock **promoted = 0;
+static int64_t promoted_count = 0;
+static int64_t promoted_capacity = 0;
+static MemoryBlock **young_views = 0;
+static int64_t young_view_count = 0;
+static int64_t young_view_capacity = 0;
+
+static void out_of_memory(int64_t size)
 {
-	cur_frame = frame;
+	// exits at once, the exit handlers might wait for the heap lock
+	fprintf(stderr, "out of memory with %li bytes of heap in use", live_bytes + allocated_bytes);
+	if(size) fprintf(stderr, " while allocating %li bytes", size);
+	fprintf(stderr, "\n");
+	flush_output();
+	fflush(stdout);
+	_exit(1);
 }
 
-void pop_frame()
+static void *check_alloc(void *ptr)
 {
-	cur_frame = cur_frame->parent;
+	if(!ptr) out_of_memory(0);
+	return ptr;
 }
 
-void *get_cur_frame()
+static int64_t env_int(char *name, int64_t fallback)
 {
-	return cur_frame;
+	char *value = getenv(name);
+	if(!value || !*value) return fallback;
+	char *end = 0;
+	int64_t result = strtoll(value, &end, 10);
+
+	switch(*end) {
+		case 'k': case 'K': result <<= 10; break;
+		case 'm': case 'M': result <<= 20; break;
+		case 'g': case 'G': result <<= 30; break;
+	}
+
+	return result;
 }
 
-void mark_array(Array *array, Type *type)
+static int64_t now_ns()
 {
-	for(int64_t i=0; i < array->length; i++) {
-		if(type->subtype->kind == TY_STRING) {
-			String *str = ((String**)array->items)[i];
-			str->block.marked = 1;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void report_gc_stats()
+{
+	FILE *fs = strcmp(gc_stats_path, "1") == 0 ? stderr : fopen(gc_stats_path, "w");
+
+	if(!fs) {
+		fprintf(stderr, "could not write gc stats to %s\n", gc_stats_path);
+		return;
+	}
+
+	write_gc_stats(fs);
+	if(fs != stderr) fclose(fs);
+}
+
+static int64_t cgroup_limit(char *dir, char *group, char *file)
+{
+	// a group is limited by the lowest limit on its way up to the root
+	char path[4096];
+	int64_t limit = 0;
+
+	while(1) {
+		snprintf(path, sizeof(path), "%s%s/%s", dir, group, file);
+		FILE *fs = fopen(path, "r");
+
+		if(fs) {
+			int64_t value = 0;
+			if(fscanf(fs, "%li", &value) == 1 && value > 0 && value < (1ll << 62) && (!limit || value < limit)) limit = value;
+			fclose(fs);
 		}
-		else if(type->subtype->kind == TY_ARRAY) {
-			Array *arr = ((Array**)array->items)[i];
-			arr->block.marked = 1;
-			mark_array(arr, type->subtype);
+
+		char *slash = strrchr(group, '/');
+		if(!slash) break;
+		*slash = 0;
+	}
+
+	return limit;
+}
+
+static int64_t memory_limit()
+{
+	FILE *fs = fopen("/proc/self/cgroup", "r");
+	if(!fs) return 0;
+	char line[4096];
+	int64_t limit = 0;
+
+	while(fgets(line, sizeof(line), fs)) {
+		line[strcspn(line, "\n")] = 0;
+		char *v1 = strstr(line, ":memory:");
+		int64_t found = 0;
+		if(strncmp(line, "0::", 3) == 0) found = cgroup_limit("/sys/fs/cgroup", line + 3, "memory.max");
+		else if(v1) found = cgroup_limit("/sys/fs/cgroup/memory", v1 + 8, "memory.limit_in_bytes");
+		if(found && (!limit || found < limit)) limit = found;
+	}
+
+	fclose(fs);
+	return limit;
+}
+
+static void init_gc()
+{
+	gc_min_heap = env_int("CRUNCHY_GC_MIN_HEAP", gc_min_heap);
+	gc_every = env_int("CRUNCHY_GC_EVERY", gc_every);
+	nursery_size = env_int("CRUNCHY_GC_NURSERY", nursery_size) & ~7;
+	gc_incremental = env_int("CRUNCHY_GC_INCREMENTAL", gc_incremental);
+	gc_slice_objects = env_int("CRUNCHY_GC_SLICE", gc_slice_objects);
+	gc_slice_us = env_int("CRUNCHY_GC_SLICE_US", gc_slice_us);
+	gc_threads = env_int("CRUNCHY_GC_THREADS", gc_threads);
+	gc_huge_pages = env_int("CRUNCHY_GC_HUGE_PAGES", gc_huge_pages);
+	gc_compact = env_int("CRUNCHY_GC_COMPACT", gc_compact);
+	gc_view_copy = env_int("CRUNCHY_GC_VIEW_COPY", gc_view_copy);
+	gc_max_heap = env_int("CRUNCHY_GC_MAX_HEAP", memory_limit() / 10 * 8);
+	if(gc_slice_objects < 1) gc_slice_objects = 1;
+	if(gc_threads < 1) gc_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	kernel_threads = env_int("CRUNCHY_KERNEL_THREADS", kernel_threads);
+	if(kernel_threads < 1) kernel_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if(kernel_threads > MAX_KERNEL_THREADS) kernel_threads = MAX_KERNEL_THREADS;
+	gc_stats_path = getenv("CRUNCHY_GC_STATS");
+	if(gc_stats_path && *gc_stats_path) atexit(report_gc_stats);
+	else gc_stats_path = 0;
+	gc_start_ns = now_ns();
+	char *growth = getenv("CRUNCHY_GC_GROWTH");
+	if(growth && *growth) gc_growth = strtod(growth, 0);
+	if(gc_growth < 1.0) gc_growth = 1.0;
+	heap_goal = gc_min_heap;
+
+	for(int64_t i=0, p=0; i <= MAX_CELL_SIZE / 16; i++) {
+		if(i * 16 > pools[p].cell_size) p ++;
+		pool_index[i] = p;
+	}
+
+	if(nursery_size > 0) {
+		young_space = mmap(0, nursery_size * MAX_NURSERIES, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+		if(young_space == MAP_FAILED) {
+			young_space = 0;
+			nursery_size = 0;
 		}
+
+		young_space_end = young_space + nursery_size * MAX_NURSERIES;
 	}
+
+	out_line_flush = isatty(1);
+	atexit(flush_output);
+	gc_initialized = 1;
 }
 
-void collect_garbage()
+static Page *page_of(MemoryBlock *block)
 {
-	for(Frame *frame = cur_frame; frame; frame = frame->parent) {
-		for(int64_t i=0; i < frame->num_gc_decls; i++) {
-			MemoryBlock *gc_obj = frame->gc_objs[i];
+	return (Page*)((uintptr_t)block & ~(uintptr_t)(PAGE_SIZE - 1));
+}
 
-			if(gc_obj && !gc_obj->marked) {
-				gc_obj->marked = 1;
+static int64_t cell_index(Page *page, MemoryBlock *block)
+{
+	return ((char*)block - page->cells) / page->cell_size;
+}
 
-				if(gc_obj->type->kind == TY_ARRAY) {
-					Array *array = (void*)gc_obj;
-					mark_array(array, gc_obj->type);
-				}
+static void *map_aligned(int64_t size, int64_t align)
+{
+	char *map = mmap(0, size + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(map == MAP_FAILED) return 0;
+	char *start = (char*)(((uintptr_t)map + align - 1) & ~(uintptr_t)(align - 1));
+	if(start > map) munmap(map, start - map);
+	munmap(start + size, map + align - start);
+	return start;
+}
+
+static void finish_sweeping();
+
+// the system refused memory, so sweep the rest of the last collection's garbage, which needs no marking, before giving up.
+// A full collection can not run here: the allocating runtime code holds pointers in C variables that are no roots
+static int reclaim_memory()
+{
+	if(gc_state != GC_SWEEPING) return 0;
+	finish_sweeping();
+	return 1;
+}
+
+static Page *new_page(Pool *pool)
+{
+	Page *page = 0;
+
+	if(free_pages) {
+		page = free_pages;
+		free_pages = page->next;
+	}
+	else if(idle_pages) {
+		page = idle_pages;
+		idle_pages = page->next;
+	}
+	else if(released_count > 0) {
+		page = released_pages[-- released_count];
+	}
+	else {
+		if(arena_next == arena_end) {
+			arena_next = map_aligned(PAGE_SIZE * ARENA_PAGES, PAGE_SIZE);
+			if(!arena_next && reclaim_memory()) {
+				arena_end = 0;
+				return new_page(pool);
 			}
+			if(!arena_next) out_of_memory(PAGE_SIZE * ARENA_PAGES);
+			arena_end = arena_next + PAGE_SIZE * ARENA_PAGES;
 		}
+
+		page = (Page*)arena_next;
+		arena_next += PAGE_SIZE;
 	}
 
-	MemoryBlock *block = memory_blocks;
-	MemoryBlock *prev = 0;
+	memset(page, 0, sizeof(Page));
+	page->cell_size = pool->cell_size;
+	page->cells = (char*)page + ((sizeof(Page) + 15) & ~15);
+	page->num_cells = ((char*)page + PAGE_SIZE - page->cells) / page->cell_size;
+	page->swept_epoch = gc_epoch;
+	page->next = pool->pages;
+	pool->pages = page;
+	return page;
+}
 
-	while(block) {
-		MemoryBlock *next = block->next;
+static void sweep_cells(Page *page)
+{
+	int64_t live_cells = 0;
 
-		if(!block->marked) {
-			if(block->type->kind == TY_ARRAY) {
-				Array *array = (Array*)block;
-				free(array->items);
-			}
+	for(int64_t w=0; w < BITMAP_WORDS; w++) {
+		page->live_bits[w] = page->mark_bits[w];
+		page->mark_bits[w] = 0;
+		live_cells += __builtin_popcountll(page->live_bits[w]);
+	}
+
+	major_record.swept_objects += page->live_cells - live_cells;
+	major_record.swept_bytes += (page->live_cells - live_cells) * page->cell_size;
+	page->swept_epoch = gc_epoch;
+	page->live_cells = live_cells;
+	page->alloc_cursor = 0;
+}
+
+static MemoryBlock *page_alloc(Pool *pool)
+{
+	for(Page *page = pool->alloc_page; page && page != pool->full_pages; page = pool->alloc_page = page->next) {
+		if(gc_state == GC_SWEEPING && page->swept_epoch != gc_epoch) sweep_cells(page);
+		if(page->live_cells == page->num_cells) continue;
 
-			if(prev) prev->next = block->next;
-			else memory_blocks = block->next;
-			free(block);
-			//printf("## collected %p \n", block);
+		for(int64_t w = page->alloc_cursor / 64; w < BITMAP_WORDS; w++) {
+			uint64_t free_bits = ~page->live_bits[w];
+			if(!free_bits) continue;
+			int64_t index = w * 64 + __builtin_ctzll(free_bits);
+			if(index >= page->num_cells) break;
+			page->live_bits[w] |= 1ull << (index & 63);
+			page->live_cells ++;
+			page->alloc_cursor = index + 1;
+			return (MemoryBlock*)(page->cells + index * page->cell_size);
 		}
-		else {
-			block->marked = 0;
-			prev = block;
+
+		page->alloc_cursor = page->num_cells;
+	}
+
+	// every page so far is full, so the walk stops there once the new page is full too
+	pool->full_pages = pool->pages;
+	Page *page = pool->alloc_page = new_page(pool);
+	page->live_bits[0] = 1;
+	page->live_cells = 1;
+	page->alloc_cursor = 1;
+	return (MemoryBlock*)page->cells;
+}
+
+static void release_idle_pages()
+{
+	while(idle_pages) {
+		Page *page = idle_pages;
+		idle_pages = page->next;
+		madvise(page, PAGE_SIZE, MADV_DONTNEED);
+
+		if(released_count == released_capacity) {
+			released_capacity = released_capacity ? released_capacity * 2 : 256;
+			released_pages = check_alloc(realloc(released_pages, sizeof(Page*) * released_capacity));
 		}
 
-		block = next;
+		released_pages[released_count ++] = page;
+	}
+
+	idle_pages = free_pages;
+	free_pages = 0;
+}
+
+static LargeObject *new_large_object(int64_t size)
+{
+	int64_t full_size = sizeof(LargeObject) + size;
+
+	if(full_size < LARGE_MAP_MIN) {
+		LargeObject *large = malloc(full_size);
+		if(!large && reclaim_memory()) return new_large_object(size);
+		if(!large) out_of_memory(size);
+		large->mapped_size = 0;
+		return large;
+	}
+
+	int64_t huge = gc_huge_pages && full_size >= HUGE_PAGE_SIZE;
+	int64_t align = huge ? HUGE_PAGE_SIZE : sysconf(_SC_PAGESIZE);
+	int64_t mapped_size = (full_size + align - 1) & ~(align - 1);
+	LargeObject *large = huge ? map_aligned(mapped_size, align) :
+		mmap(0, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if((!large || large == MAP_FAILED) && reclaim_memory()) return new_large_object(size);
+	if(!large || large == MAP_FAILED) out_of_memory(size);
+	if(huge) madvise(large, mapped_size, MADV_HUGEPAGE);
+	large->mapped_size = mapped_size;
+	return large;
+}
+
+static void free_large_object(LargeObject *large)
+{
+	if(large->mapped_size) munmap(large, large->mapped_size);
+	else free(large);
+}
+
+static void link_large_object(LargeObject *large, int64_t size)
+{
+	large->next = large_objects;
+	large->size = size;
+	large->marked = gc_state == GC_MARKING;
+	large->block->flags = GC_LARGE;
+	large_objects = large;
+	if(large->marked) {
+		marked_objects ++;
+		marked_bytes += size;
 	}
 }
 
-void *new_memory_block(Type *type, int64_t size)
+static MemoryBlock *heap_alloc(int64_t size)
 {
-	collect_garbage();
-	MemoryBlock *block = malloc(size);
-	block->next = memory_blocks;
-	block->type = type;
-	block->marked = 0;
-	memory_blocks = block;
+	if(size > MAX_CELL_SIZE) {
+		LargeObject *large = new_large_object(size);
+		link_large_object(large, size);
+		return large->block;
+	}
+
+	MemoryBlock *block = page_alloc(&pools[pool_index[(size + 15) / 16]]);
+	block->flags = 0;
+
+	if(gc_state != GC_IDLE) {
+		Page *page = page_of(block);
+
+		if(page->swept_epoch != gc_epoch) {
+			int64_t index = cell_index(page, block);
+			page->mark_bits[index / 64] |= 1ull << (index & 63);
+			marked_objects ++;
+			marked_bytes += page->cell_size;
+		}
+	}
+
 	return block;
 }
 
-String *new_string(int64_t length, char *chars)
+static void *new_buffer(int64_t size)
 {
-	int64_t size = sizeof(String) + length + 1;
-	String *string = new_memory_block(&t_string, size);
-	string->length = length;
-	memcpy(string->chars, chars, length);
-	string->chars[length] = 0;
-	//printf("## created %s %p \n", string->chars, string);
-	return string;
+	MemoryBlock *block = heap_alloc(sizeof(MemoryBlock) + size);
+	block->type = 0;
+	return block + 1;
 }
 
-Array *new_array(Type *type, int64_t length, void *data)
+static int mark_block(MemoryBlock *block)
 {
-	int64_t itemsize =
-		type->kind == TY_INT ? sizeof(int64_t) :
-		type->kind == TY_BOOL ? sizeof(uint8_t) :
-		type->kind == TY_INT ? sizeof(String*) :
-		type->kind == TY_FUNC ? sizeof(Function) :
-		type->kind == TY_ARRAY ? sizeof(Array*) :
-		sizeof(void*);
+	if(block->flags & GC_STATIC) return 0;
 
-	Array *array = new_memory_block(type, sizeof(Array));
-	array->length = length;
-	int64_t data_size = itemsize * length;
-	array->items = calloc(length, itemsize);
-	memcpy(array->items, data, data_size);
-	//printf("## created array with %li elms %p \n", length, array);
-	return array;
+	if(block->flags & GC_LARGE) {
+		LargeObject *large = (LargeObject*)((char*)block - sizeof(LargeObject));
+		if(large->marked) return 0;
+		large->marked = 1;
+		marked_objects ++;
+		marked_bytes += large->size;
+		return 1;
+	}
+
+	Page *page = page_of(block);
+	int64_t index = cell_index(page, block);
+	uint64_t bit = 1ull << (index & 63);
+	if(page->mark_bits[index / 64] & bit) return 0;
+	page->mark_bits[index / 64] |= bit;
+	marked_objects ++;
+	marked_bytes += page->cell_size;
+	return 1;
 }
 
-void print_string(String *str)
+static uint32_t register_type(Type *type)
 {
-	fwrite(str->chars, 1, str->length, stdout);
+	pthread_mutex_lock(&type_lock);
+
+	if(!type->id) {
+		if(type_count + 2 > type_capacity) {
+			// the old table is kept because other threads may still read from it
+			type_capacity *= 2;
+			Type **table = check_alloc(malloc(sizeof(Type*) * type_capacity));
+			memcpy(table, type_table, sizeof(Type*) * (type_count + 1));
+			__atomic_store_n(&type_table, table, __ATOMIC_RELEASE);
+		}
+
+		type_table[type_count + 1] = type;
+		__atomic_store_n(&type->id, ++ type_count, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&type_lock);
+	return type->id;
 }
 
-void print_array(Array *array, Type *type)
+static uint32_t type_index(Type *type)
 {
-	printf("[");
+	uint32_t id = __atomic_load_n(&type->id, __ATOMIC_ACQUIRE);
+	return id ? id : register_type(type);
+}
 
-	for(int64_t i=0; i < array->length; i++) {
-		if(i > 0) printf(", ");
+static Type *block_type(MemoryBlock *block)
+{
+	return __atomic_load_n(&type_table, __ATOMIC_ACQUIRE)[block->type];
+}
 
-		switch(type->subtype->kind) {
-			case TY_INT:
-				printf("%li", ((int64_t*)array->items)[i]);
-				break;
-			case TY_BOOL:
-				printf("%s", ((uint8_t*)array->items)[i] ? "true" : "false");
-				break;
-			case TY_STRING:
-				print_string(((String**)array->items)[i]);
-				break;
-			case TY_FUNC:
-				printf("<Function>");
-				break;
-			case TY_ARRAY:
-				print_array(((Array**)array->items)[i], type->subtype);
-				break;
+static int is_young(void *ptr)
+{
+	return (char*)ptr >= young_space && (char*)ptr < young_space_end;
+}
+
+static void push_block(MemoryBlock ***list, int64_t *count, int64_t *capacity, MemoryBlock *block)
+{
+	if(*count == *capacity) {
+		*capacity = *capacity ? *capacity * 2 : 256;
+		*list = check_alloc(realloc(*list, sizeof(MemoryBlock*) * *capacity));
+	}
+
+	(*list)[(*count) ++] = block;
+}
+
+static int is_gc_ref(Type *type)
+{
+	return type->kind == TY_STRING || type->kind == TY_ARRAY || type->kind == TY_MAP;
+}
+
+static int64_t item_size(Type *type)
+{
+	switch(type->kind) {
+		case TY_INT: return sizeof(int64_t);
+		case TY_BOOL: return sizeof(uint8_t);
+		case TY_STRING: return sizeof(String*);
+		case TY_FUNC: return sizeof(Function);
+		case TY_ARRAY: return sizeof(Array*);
+		case TY_MAP: return sizeof(Map*);
+		default: return sizeof(void*);
+	}
+}
+
+static int has_inline_items(Array *array)
+{
+	return array->items == (void*)(array + 1);
+}
+
+static int has_ref_items(MemoryBlock *block)
+{
+	Type *type = block_type(block);
+	if(type->kind == TY_MAP) return is_gc_ref(type->keytype) || is_gc_ref(type->subtype);
+	return type->kind == TY_ARRAY && is_gc_ref(type->subtype);
+}
+
+static MapSlot *map_slots(Map *map)
+{
+	return (MapSlot*)(map->ctrl + map->capacity);
+}
+
+static int64_t table_size(int64_t capacity)
+{
+	return capacity * (1 + sizeof(MapSlot));
+}
+
+static void update_slots(Map *map, MemoryBlock *(*update)(MemoryBlock *block))
+{
+	Type *type = block_type(&map->block);
+	int64_t ref_keys = is_gc_ref(type->keytype);
+	int64_t ref_values = is_gc_ref(type->subtype);
+	MapSlot *slots = map_slots(map);
+
+	for(int64_t i=0; i < map->capacity; i++) {
+		if(map->ctrl[i] & CTRL_EMPTY) continue;
+		if(ref_keys) slots[i].key = (int64_t)update((MemoryBlock*)slots[i].key);
+		if(ref_values) slots[i].value = (int64_t)update((MemoryBlock*)slots[i].value);
+	}
+}
+
+static MemoryBlock **view_base(MemoryBlock *view)
+{
+	if(block_type(view)->kind == TY_STRING) return &((StringView*)view)->base;
+	return &((ArrayView*)view)->base;
+}
+
+static char **view_data(MemoryBlock *view)
+{
+	if(block_type(view)->kind == TY_STRING) return &((String*)view)->chars;
+	return (char**)&((Array*)view)->items;
+}
+
+static int64_t view_size(MemoryBlock *view)
+{
+	Type *type = block_type(view);
+	if(type->kind == TY_STRING) return ((String*)view)->length;
+	return ((Array*)view)->length * item_size(type->subtype);
+}
+
+static void rebase_view(MemoryBlock *view, MemoryBlock *base)
+{
+	MemoryBlock **old_base = view_base(view);
+	char **data = view_data(view);
+	*data = (char*)base + (*data - (char*)*old_base);
+	*old_base = base;
+}
+
+static int64_t block_size(MemoryBlock *block)
+{
+	Type *type = block_type(block);
+
+	if(block->flags & GC_VIEW) {
+		return type->kind == TY_STRING ? sizeof(StringView) : sizeof(ArrayView);
+	}
+	else if(type->kind == TY_STRING) {
+		String *string = (String*)block;
+		return sizeof(String) + string->length + 1;
+	}
+	else if(type->kind == TY_ARRAY) {
+		Array *array = (Array*)block;
+		if(!has_inline_items(array)) return sizeof(Array);
+		return sizeof(Array) + array->capacity * item_size(type->subtype);
+	}
+	else if(type->kind == TY_MAP) {
+		return sizeof(Map);
+	}
+
+	return sizeof(MemoryBlock);
+}
+
+static MemoryBlock *evacuate(MemoryBlock *block);
+static void mark_base(MemoryBlock *base);
+
+static void evacuate_view(MemoryBlock *view)
+{
+	MemoryBlock *base = *view_base(view);
+
+	if(!is_young(base)) {
+		if(gc_state == GC_MARKING) mark_base(base);
+		return;
+	}
+
+	// young bases are handled once all other live objects are evacuated, so a base still in use is always shared
+	push_block(&young_views, &young_view_count, &young_view_capacity, view);
+}
+
+static char *copy_view_data(MemoryBlock *base, char *data, int64_t size)
+{
+	char *copy = new_buffer(size);
+	memcpy(copy, data, size);
+	((MemoryBlock*)copy - 1)->flags |= base->flags & GC_SITE_MASK;
+	allocated_bytes += sizeof(MemoryBlock) + size;
+	minor_record.objects ++;
+	minor_record.bytes += sizeof(MemoryBlock) + size;
+	return copy;
+}
+
+static int compare_view_bases(const void *a, const void *b)
+{
+	MemoryBlock *left = *view_base(*(MemoryBlock**)a);
+	MemoryBlock *right = *view_base(*(MemoryBlock**)b);
+	return left < right ? -1 : left > right;
+}
+
+static void evacuate_young_views()
+{
+	if(!young_view_count) return;
+	qsort(young_views, young_view_count, sizeof(MemoryBlock*), compare_view_bases);
+
+	for(int64_t i=0, end=0; i < young_view_count; i = end) {
+		MemoryBlock *base = *view_base(young_views[i]);
+		for(end = i; end < young_view_count && *view_base(young_views[end]) == base; end++);
+
+		if(base->flags & GC_FORWARDED) {
+			for(int64_t j=i; j < end; j++) rebase_view(young_views[j], *(MemoryBlock**)(base + 1));
+		}
+		else if(block_type(young_views[i])->kind == TY_STRING) {
+			// strings can not change, so a small view may get its own copy instead of keeping the whole string alive
+			for(int64_t j=i; j < end; j++) {
+				MemoryBlock *view = young_views[j];
+
+				if(!gc_view_copy || view_size(view) * gc_view_copy >= block_size(base)) {
+					rebase_view(view, evacuate(base));
+				}
+				else {
+					*view_data(view) = copy_view_data(base, *view_data(view), view_size(view));
+					*view_base(view) = (MemoryBlock*)*view_data(view) - 1;
+				}
+			}
+		}
+		else {
+			// only views still use these items, they share one copy of them up to the end of the last view
+			char *items = base->type ? ((Array*)base)->items : (char*)(base + 1);
+			int64_t size = 0;
+
+			for(int64_t j=i; j < end; j++) {
+				int64_t view_end = *view_data(young_views[j]) + view_size(young_views[j]) - items;
+				if(view_end > size) size = view_end;
+			}
+
+			char *copy = copy_view_data(base, items, size);
+
+			for(int64_t j=i; j < end; j++) {
+				*view_data(young_views[j]) = copy + (*view_data(young_views[j]) - items);
+				*view_base(young_views[j]) = (MemoryBlock*)copy - 1;
+			}
 		}
 	}
 
-	printf("]");
+	young_view_count = 0;
 }
 
-String *concat_strings(String *left, String *right)
+static MemoryBlock *evacuate(MemoryBlock *block)
 {
-	int64_t length = left->length + right->length;
-	int64_t size = sizeof(String) + length + 1;
-	String *string = new_memory_block(&t_string, size);
-	string->length = length;
-	memcpy(string->chars, left->chars, left->length);
-	memcpy(string->chars + left->length, right->chars, right->length);
-	string->chars[length] = 0;
-	//printf("## concated %s\n", string->chars);
-	return string;
+	if(!block || !is_young(block)) return block;
+	MemoryBlock **forward = (MemoryBlock**)(block + 1);
+	if(block->flags & GC_FORWARDED) return *forward;
+	int64_t size = block_size(block);
+	MemoryBlock *copy = heap_alloc(size);
+	uint32_t flags = copy->flags;
+	memcpy(copy, block, size);
+	copy->flags = flags | (block->flags & (GC_VIEW | GC_SITE_MASK));
+	block->flags |= GC_FORWARDED;
+	*forward = copy;
+	allocated_bytes += size;
+	minor_record.objects ++;
+	minor_record.bytes += size;
+	Type *type = block_type(copy);
+
+	if(copy->flags & GC_VIEW) {
+		evacuate_view(copy);
+	}
+	else if(type->kind == TY_STRING) {
+		((String*)copy)->chars = (char*)((String*)copy + 1);
+	}
+	else if(type->kind == TY_ARRAY) {
+		Array *array = (Array*)copy;
+
+		if(has_inline_items((Array*)block)) {
+			array->items = array + 1;
+		}
+		else if(is_young(array->items)) {
+			MemoryBlock *buffer = (MemoryBlock*)array->items - 1;
+			int64_t items_size = array->capacity * item_size(type->subtype);
+			void *items = new_buffer(items_size);
+			memcpy(items, array->items, array->length * item_size(type->subtype));
+			((MemoryBlock*)items - 1)->flags |= buffer->flags & GC_SITE_MASK;
+			buffer->flags |= GC_FORWARDED;
+			*(MemoryBlock**)(buffer + 1) = (MemoryBlock*)items - 1;
+			array->items = items;
+			allocated_bytes += sizeof(MemoryBlock) + items_size;
+		}
+	}
+	else if(type->kind == TY_MAP) {
+		Map *map = (Map*)copy;
+
+		if(is_young(map->ctrl)) {
+			MemoryBlock *buffer = (MemoryBlock*)map->ctrl - 1;
+			uint8_t *ctrl = new_buffer(table_size(map->capacity));
+			memcpy(ctrl, map->ctrl, table_size(map->capacity));
+			((MemoryBlock*)ctrl - 1)->flags |= buffer->flags & GC_SITE_MASK;
+			buffer->flags |= GC_FORWARDED;
+			*(MemoryBlock**)(buffer + 1) = (MemoryBlock*)ctrl - 1;
+			map->ctrl = ctrl;
+			allocated_bytes += sizeof(MemoryBlock) + table_size(map->capacity);
+		}
+	}
+
+	if(has_ref_items(copy)) push_block(&promoted, &promoted_count, &promoted_capacity, copy);
+	return copy;
+}
+
+static void evacuate_items(Array *array)
+{
+	MemoryBlock **items = array->items;
+	for(int64_t i=0; i < array->length; i++) items[i] = evacuate(items[i]);
+}
+
+static void evacuate_refs(MemoryBlock *block)
+{
+	if(block_type(block)->kind == TY_MAP) update_slots((Map*)block, evacuate);
+	else evacuate_items((Array*)block);
+}
+
+static void evacuate_frame(Frame *frame)
+{
+	for(int64_t i=0; i < frame->num_gc_decls; i++) {
+		frame->gc_objs[i] = evacuate(frame->gc_objs[i]);
+	}
+
+	frame->remembered = 0;
+}
+
+static int64_t heap_bytes()
+{
+	int64_t bytes = live_bytes + allocated_bytes;
+
+	for(Mutator *m = mutators; m; m = m->next) {
+		bytes += __atomic_load_n(&m->nursery_top, __ATOMIC_RELAXED) - m->nursery;
+	}
+
+	return bytes;
+}
+
+static void update_peak_heap()
+{
+	int64_t bytes = heap_bytes();
+	if(bytes > gc_stats.peak_heap_bytes) gc_stats.peak_heap_bytes = bytes;
+}
+
+static void start_record(GcRecord *record, int64_t major, int64_t start_ns)
+{
+	memset(record, 0, sizeof(GcRecord));
+	record->major = major;
+	record->start_ns = start_ns - gc_start_ns;
+}
+
+static void add_pause(GcRecord *record, int64_t start_ns)
+{
+	int64_t pause = now_ns() - start_ns;
+	record->pause_ns += pause;
+	record->pauses ++;
+	if(pause > record->max_pause_ns) record->max_pause_ns = pause;
+	gc_stats.pause_ns += pause;
+	if(pause > gc_stats.max_pause_ns) gc_stats.max_pause_ns = pause;
+}
+
+static void finish_record(GcRecord *record)
+{
+	if(!gc_stats_path) return;
+
+	if(gc_record_count == gc_record_capacity) {
+		gc_record_capacity = gc_record_capacity ? gc_record_capacity * 2 : 256;
+		gc_records = check_alloc(realloc(gc_records, sizeof(GcRecord) * gc_record_capacity));
+	}
+
+	gc_records[gc_record_count ++] = *record;
+}
+
+static void fold_alloc_stats(Mutator *m)
+{
+	#define _(name) gc_stats.name += m->stats.name; m->stats.name = 0;
+	_(strings) _(string_bytes) _(arrays) _(array_bytes) _(concats) _(concat_bytes) _(views) _(view_bytes)
+	#undef _
+}
+
+static void release_mutator(Mutator *m)
+{
+	if(m->nursery) {
+		madvise(m->nursery, nursery_size, MADV_DONTNEED);
+		nursery_used[(m->nursery - young_space) / nursery_size] = 0;
+	}
+
+	free(m->remembered_set);
+	free(m);
+}
+
+static void collect_nursery()
+{
+	int64_t start = now_ns();
+	update_peak_heap();
+	start_record(&minor_record, 0, start);
+
+	for(Mutator *m = mutators; m; m = m->next) {
+		int64_t below_watermark = 0;
+
+		for(Frame *frame = m->cur_frame; frame; frame = frame->parent) {
+			if(!below_watermark || frame->remembered) {
+				evacuate_frame(frame);
+				minor_record.frames_scanned ++;
+			}
+
+			if(frame == m->frame_watermark) below_watermark = 1;
+		}
+	}
+
+	for(Mutator *m = mutators; m; m = m->next) {
+		for(int64_t i=0; i < m->remembered_count; i++) {
+			MemoryBlock *block = m->remembered_set[i];
+			block->flags &= ~GC_REMEMBERED;
+			if(block->flags & GC_VIEW) evacuate_view(block);
+			if(has_ref_items(block)) evacuate_refs(block);
+		}
+
+		m->remembered_count = 0;
+	}
+
+	while(promoted_count > 0) {
+		evacuate_refs(promoted[-- promoted_count]);
+	}
+
+	evacuate_young_views();
+
+	for(Mutator **link = &mutators; *link;) {
+		Mutator *m = *link;
+		m->nursery_top = m->nursery;
+		m->frame_watermark = m->cur_frame;
+		fold_alloc_stats(m);
+
+		if(m->detached) {
+			*link = m->next;
+			release_mutator(m);
+		}
+		else {
+			link = &m->next;
+		}
+	}
+
+	__atomic_store_n(&minor_gc_pending, 0, __ATOMIC_RELAXED);
+	gc_stats.minor_collections ++;
+	gc_stats.frames_scanned += minor_record.frames_scanned;
+	gc_stats.promoted_objects += minor_record.objects;
+	gc_stats.promoted_bytes += minor_record.bytes;
+	add_pause(&minor_record, start);
+	finish_record(&minor_record);
+}
+
+static void remember(MemoryBlock *block)
+{
+	if(!(block->flags & GC_REMEMBERED)) {
+		block->flags |= GC_REMEMBERED;
+		push_block(&mutator->remembered_set, &mutator->remembered_count, &mutator->remembered_capacity, block);
+	}
+}
+
+static void write_barrier(MemoryBlock *block, MemoryBlock *value)
+{
+	if(value && is_young(value) && !is_young(block)) remember(block);
+}
+
+static void mark(MemoryBlock *block)
+{
+	if(!block || is_young(block) || !mark_block(block)) return;
+	if(block->flags & GC_VIEW) mark_base(*view_base(block));
+	Type *type = block_type(block);
+
+	if(type->kind == TY_MAP) {
+		Map *map = (Map*)block;
+		if(map->ctrl) mark_block((MemoryBlock*)map->ctrl - 1);
+		if(has_ref_items(block) && map->length > 0) push_block(&mark_stack, &mark_stack_count, &mark_stack_capacity, block);
+		return;
+	}
+
+	if(type->kind != TY_ARRAY) return;
+	Array *array = (Array*)block;
+	if(!(block->flags & GC_VIEW) && !has_inline_items(array)) mark_block((MemoryBlock*)array->items - 1);
+
+	if(is_gc_ref(type->subtype) && array->length > 0) {
+		push_block(&mark_stack, &mark_stack_count, &mark_stack_capacity, block);
+	}
+}
+
+static void mark_base(MemoryBlock *base)
+{
+	if(base->type) mark(base);
+	else if(!is_young(base)) mark_block(base);
+}
+
+static MemoryBlock *mark_ref(MemoryBlock *block)
+{
+	mark(block);
+	return block;
+}
+
+static void start_slice()
+{
+	if(!gc_slice_us) return;
+	clock_gettime(CLOCK_MONOTONIC, &slice_deadline);
+	slice_deadline.tv_nsec += gc_slice_us * 1000;
+	slice_deadline.tv_sec += slice_deadline.tv_nsec / 1000000000;
+	slice_deadline.tv_nsec %= 1000000000;
+}
+
+static int slice_expired()
+{
+	if(!gc_slice_us) return 0;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec > slice_deadline.tv_sec ||
+		(now.tv_sec == slice_deadline.tv_sec && now.tv_nsec >= slice_deadline.tv_nsec);
+}
+
+static void start_cycle()
+{
+	gc_epoch ++;
+	gc_state = GC_MARKING;
+	marked_objects = 0;
+	marked_bytes = 0;
+	start_record(&major_record, 1, now_ns());
+}
+
+static void mark_roots()
+{
+	for(Mutator *m = mutators; m; m = m->next) {
+		for(Frame *frame = m->cur_frame; frame; frame = frame->parent) {
+			for(int64_t i=0; i < frame->num_gc_decls; i++) mark(frame->gc_objs[i]);
+			major_record.frames_scanned ++;
+		}
+	}
+}
+
+static int mark_slice(int64_t budget)
+{
+	for(int64_t steps = 1; budget > 0; steps ++) {
+		if(!scan_array) {
+			if(mark_stack_count == 0) return 1;
+			MemoryBlock *block = mark_stack[-- mark_stack_count];
+
+			// a map is scanned in one go, since a rehash in between two slices would reorder its slots
+			if(block_type(block)->kind == TY_MAP) {
+				update_slots((Map*)block, mark_ref);
+				budget -= ((Map*)block)->length + 1;
+				continue;
+			}
+
+			scan_array = (Array*)block;
+			scan_index = 0;
+		}
+
+		MemoryBlock **items = scan_array->items;
+		int64_t chunk = scan_array->length - scan_index;
+		if(chunk > budget) chunk = budget;
+		if(chunk > 256) chunk = 256;
+		budget -= chunk + 1;
+		for(int64_t end = scan_index + chunk; scan_index < end; scan_index++) mark(items[scan_index]);
+		if(scan_index == scan_array->length) scan_array = 0;
+		if((steps & 15) == 0 && slice_expired()) break;
+	}
+
+	return 0;
+}
+
+static int mark_block_atomic(MarkDeque *deque, MemoryBlock *block)
+{
+	if(block->flags & GC_STATIC) return 0;
+
+	if(block->flags & GC_LARGE) {
+		LargeObject *large = (LargeObject*)((char*)block - sizeof(LargeObject));
+		if(__atomic_load_n(&large->marked, __ATOMIC_RELAXED)) return 0;
+		if(__atomic_exchange_n(&large->marked, 1, __ATOMIC_RELAXED)) return 0;
+		deque->marked_objects ++;
+		deque->marked_bytes += large->size;
+		return 1;
+	}
+
+	Page *page = page_of(block);
+	int64_t index = cell_index(page, block);
+	uint64_t bit = 1ull << (index & 63);
+	uint64_t *word = &page->mark_bits[index / 64];
+	if(__atomic_load_n(word, __ATOMIC_RELAXED) & bit) return 0;
+	if(__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit) return 0;
+	deque->marked_objects ++;
+	deque->marked_bytes += page->cell_size;
+	return 1;
+}
+
+static void deque_push(MarkDeque *deque, MarkTask task)
+{
+	int64_t bottom = deque->bottom;
+	int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	TaskBuffer *buffer = deque->buffer;
+
+	if(bottom - top > buffer->mask) {
+		TaskBuffer *grown = check_alloc(malloc(sizeof(TaskBuffer) + sizeof(MarkTask) * (buffer->mask + 1) * 2));
+		grown->retired = buffer;
+		grown->mask = buffer->mask * 2 + 1;
+		for(int64_t i = top; i < bottom; i++) grown->tasks[i & grown->mask] = buffer->tasks[i & buffer->mask];
+		__atomic_store_n(&deque->buffer, grown, __ATOMIC_RELEASE);
+		buffer = grown;
+	}
+
+	buffer->tasks[bottom & buffer->mask] = task;
+	__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+}
+
+static int deque_pop(MarkDeque *deque, MarkTask *task)
+{
+	int64_t bottom = deque->bottom - 1;
+	TaskBuffer *buffer = deque->buffer;
+	__atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+	if(top > bottom) {
+		__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	*task = buffer->tasks[bottom & buffer->mask];
+	if(top < bottom) return 1;
+	int won = __atomic_compare_exchange_n(&deque->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+	__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+	return won;
+}
+
+static int deque_steal(MarkDeque *deque, MarkTask *task)
+{
+	int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+	if(top >= bottom) return 0;
+	TaskBuffer *buffer = __atomic_load_n(&deque->buffer, __ATOMIC_ACQUIRE);
+	MarkTask stolen = buffer->tasks[top & buffer->mask];
+	if(!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return 0;
+	*task = stolen;
+	return 1;
+}
+
+static void mark_shared(MarkDeque *deque, MemoryBlock *block)
+{
+	if(!block || is_young(block) || !mark_block_atomic(deque, block)) return;
+
+	if(block->flags & GC_VIEW) {
+		MemoryBlock *base = *view_base(block);
+		if(base->type) mark_shared(deque, base);
+		else if(!is_young(base)) mark_block_atomic(deque, base);
+	}
+
+	Type *type = block_type(block);
+
+	if(type->kind == TY_MAP) {
+		Map *map = (Map*)block;
+		if(!map->ctrl) return;
+		mark_block_atomic(deque, (MemoryBlock*)map->ctrl - 1);
+		MapSlot *slots = map_slots(map);
+
+		for(int64_t i=0; i < map->capacity; i++) {
+			if(map->ctrl[i] & CTRL_EMPTY) continue;
+			if(is_gc_ref(type->keytype)) mark_shared(deque, (MemoryBlock*)slots[i].key);
+			if(is_gc_ref(type->subtype)) mark_shared(deque, (MemoryBlock*)slots[i].value);
+		}
+
+		return;
+	}
+
+	if(type->kind != TY_ARRAY) return;
+	Array *array = (Array*)block;
+	if(!(block->flags & GC_VIEW) && !has_inline_items(array)) mark_block_atomic(deque, (MemoryBlock*)array->items - 1);
+
+	if(is_gc_ref(type->subtype) && array->length > 0) {
+		deque_push(deque, (MarkTask){array->items, array->length});
+	}
+}
+
+static int steal_task(MarkDeque *deque, MarkTask *task)
+{
+	__atomic_fetch_add(&markers_idle, 1, __ATOMIC_SEQ_CST);
+
+	while(1) {
+		for(int64_t i=1; i < gc_threads; i++) {
+			MarkDeque *victim = &mark_deques[(deque - mark_deques + i) % gc_threads];
+
+			if(deque_steal(victim, task)) {
+				__atomic_fetch_sub(&markers_idle, 1, __ATOMIC_SEQ_CST);
+				return 1;
+			}
+		}
+
+		if(__atomic_load_n(&markers_idle, __ATOMIC_SEQ_CST) == gc_threads) return 0;
+		sched_yield();
+	}
+}
+
+static void run_marker(MarkDeque *deque)
+{
+	MarkTask task;
+
+	while(deque_pop(deque, &task) || steal_task(deque, &task)) {
+		if(task.count > MARK_CHUNK) {
+			deque_push(deque, (MarkTask){task.items + MARK_CHUNK, task.count - MARK_CHUNK});
+			task.count = MARK_CHUNK;
+		}
+
+		for(int64_t i=0; i < task.count; i++) mark_shared(deque, task.items[i]);
+	}
+}
+
+static void *marker_thread(void *arg)
+{
+	int64_t round = 0;
+	pthread_mutex_lock(&marker_lock);
+
+	while(1) {
+		while(mark_round == round) pthread_cond_wait(&marker_wake, &marker_lock);
+		round = mark_round;
+		pthread_mutex_unlock(&marker_lock);
+		run_marker(arg);
+		pthread_mutex_lock(&marker_lock);
+		markers_done ++;
+		pthread_cond_signal(&marker_finished);
+	}
+
+	return 0;
+}
+
+static void start_markers()
+{
+	mark_deques = check_alloc(calloc(gc_threads, sizeof(MarkDeque)));
+
+	for(int64_t i=0; i < gc_threads; i++) {
+		mark_deques[i].buffer = check_alloc(malloc(sizeof(TaskBuffer) + sizeof(MarkTask) * 1024));
+		mark_deques[i].buffer->retired = 0;
+		mark_deques[i].buffer->mask = 1023;
+	}
+
+	sigset_t prof_signal, old_mask;
+	sigemptyset(&prof_signal);
+	sigaddset(&prof_signal, SIGPROF);
+	pthread_sigmask(SIG_BLOCK, &prof_signal, &old_mask);
+
+	for(int64_t i=1; i < gc_threads; i++) {
+		pthread_t thread;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+		if(pthread_create(&thread, &attr, marker_thread, &mark_deques[i])) {
+			gc_threads = i;
+			break;
+		}
+
+		pthread_attr_destroy(&attr);
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old_mask, 0);
+	markers_started = 1;
+}
+
+static void mark_in_parallel()
+{
+	if(!markers_started) start_markers();
+	int64_t next = 0;
+
+	for(Mutator *m = mutators; m; m = m->next) {
+		for(Frame *frame = m->cur_frame; frame; frame = frame->parent) {
+			major_record.frames_scanned ++;
+			if(frame->num_gc_decls == 0) continue;
+			deque_push(&mark_deques[next], (MarkTask){frame->gc_objs, frame->num_gc_decls});
+			next = (next + 1) % gc_threads;
+		}
+	}
+
+	markers_idle = 0;
+	pthread_mutex_lock(&marker_lock);
+	mark_round ++;
+	pthread_cond_broadcast(&marker_wake);
+	pthread_mutex_unlock(&marker_lock);
+	run_marker(&mark_deques[0]);
+	pthread_mutex_lock(&marker_lock);
+	while(markers_done < gc_threads - 1) pthread_cond_wait(&marker_finished, &marker_lock);
+	markers_done = 0;
+	pthread_mutex_unlock(&marker_lock);
+
+	for(int64_t i=0; i < gc_threads; i++) {
+		TaskBuffer *buffer = mark_deques[i].buffer;
+		marked_objects += mark_deques[i].marked_objects;
+		marked_bytes += mark_deques[i].marked_bytes;
+		mark_deques[i].marked_objects = 0;
+		mark_deques[i].marked_bytes = 0;
+
+		while(buffer->retired) {
+			TaskBuffer *retired = buffer->retired;
+			buffer->retired = retired->retired;
+			free(retired);
+		}
+	}
+}
+
+static int sweep_large_objects(int64_t budget)
+{
+	while(unswept_large_objects) {
+		if(budget -- <= 0) return 0;
+		LargeObject *large = unswept_large_objects;
+		unswept_large_objects = large->next;
+
+		if(!large->marked) {
+			major_record.swept_objects ++;
+			major_record.swept_bytes += large->size;
+			free_large_object(large);
+			continue;
+		}
+
+		large->marked = 0;
+		large->next = large_objects;
+		large_objects = large;
+	}
+
+	return 1;
+}
+
+static void finish_marking()
+{
+	major_record.objects = marked_objects;
+	major_record.bytes = marked_bytes;
+	gc_stats.frames_scanned += major_record.frames_scanned;
+	gc_stats.marked_objects += marked_objects;
+	gc_stats.marked_bytes += marked_bytes;
+	live_bytes = marked_bytes;
+	allocated_bytes = 0;
+	for(Mutator *m = mutators; m; m = m->next) m->allocs_since_gc = 0;
+	heap_goal = live_bytes * gc_growth;
+	if(heap_goal < gc_min_heap) heap_goal = gc_min_heap;
+	// near the heap limit the next collection comes halfway between the live data and the limit
+	if(gc_max_heap && heap_goal > gc_max_heap) heap_goal = live_bytes + (gc_max_heap - live_bytes) / 2;
+	__atomic_store_n(&major_gc_pending, 0, __ATOMIC_RELAXED);
+	unswept_large_objects = large_objects;
+	large_objects = 0;
+
+	for(Pool *pool = pools; pool < pools + sizeof(pools) / sizeof(Pool); pool++) {
+		pool->alloc_page = pool->pages;
+		pool->full_pages = 0;
+	}
+
+	sweep_pool = pools;
+	sweep_link = &pools[0].pages;
+	gc_state = GC_SWEEPING;
+}
+
+static void sweep_page(Pool *pool, Page **link)
+{
+	Page *page = *link;
+	sweep_cells(page);
+
+	if(page->live_cells == 0) {
+		*link = page->next;
+		if(pool->alloc_page == page) pool->alloc_page = page->next;
+		page->next = free_pages;
+		free_pages = page;
+	}
+}
+
+static int sweep_slice(int64_t budget)
+{
+	Pool *pools_end = pools + sizeof(pools) / sizeof(Pool);
+
+	while(sweep_pool < pools_end) {
+		while(*sweep_link) {
+			if(budget -- <= 0 || ((budget & 15) == 0 && slice_expired())) return 0;
+			Page *page = *sweep_link;
+
+			if(page->swept_epoch == gc_epoch) {
+				sweep_link = &page->next;
+				continue;
+			}
+
+			sweep_page(sweep_pool, sweep_link);
+			if(*sweep_link == page) sweep_link = &page->next;
+		}
+
+		sweep_pool ++;
+		if(sweep_pool < pools_end) sweep_link = &sweep_pool->pages;
+	}
+
+	return sweep_large_objects(budget);
+}
+
+static int64_t block_site(MemoryBlock *block)
+{
+	return block->flags >> GC_SITE_SHIFT;
+}
+
+static void census_sites()
+{
+	site_censuses ++;
+	for(int64_t i=0; i < site_count; i++) site_stats[i].live_bytes = 0;
+
+	for(Pool *pool = pools; pool < pools + sizeof(pools) / sizeof(Pool); pool++) {
+		for(Page *page = pool->pages; page; page = page->next) {
+			for(int64_t w=0; w < BITMAP_WORDS; w++) {
+				for(uint64_t bits = page->live_bits[w]; bits; bits &= bits - 1) {
+					MemoryBlock *block = (MemoryBlock*)(page->cells + (w * 64 + __builtin_ctzll(bits)) * page->cell_size);
+					site_stats[block_site(block)].live_bytes += page->cell_size;
+				}
+			}
+		}
+	}
+
+	for(LargeObject *large = large_objects; large; large = large->next) {
+		site_stats[block_site(large->block)].live_bytes += large->size;
+	}
+
+	for(int64_t i=0; i < site_count; i++) {
+		if(site_stats[i].live_bytes > site_stats[i].peak_live_bytes)
+			site_stats[i].peak_live_bytes = site_stats[i].live_bytes;
+	}
+}
+
+static void finish_cycle()
+{
+	gc_stats.major_collections ++;
+	gc_stats.swept_objects += major_record.swept_objects;
+	gc_stats.swept_bytes += major_record.swept_bytes;
+	gc_stats.moved_objects += major_record.moved_objects;
+	gc_stats.moved_bytes += major_record.moved_bytes;
+	finish_record(&major_record);
+	if(site_stats) census_sites();
+	release_idle_pages();
+	gc_state = GC_IDLE;
+}
+
+static void gc_step()
+{
+	int64_t start = now_ns();
+	start_slice();
+
+	if(gc_state == GC_MARKING) {
+		if(mark_slice(gc_slice_objects)) finish_marking();
+		add_pause(&major_record, start);
+	}
+	else if(gc_state == GC_SWEEPING) {
+		int done = sweep_slice(gc_slice_objects / 64 + 1);
+		add_pause(&major_record, start);
+		if(done) finish_cycle();
+	}
+}
+
+static void finish_sweeping()
+{
+	int64_t slice_us = gc_slice_us;
+	int64_t start = now_ns();
+	gc_slice_us = 0;
+	sweep_slice(INT64_MAX);
+	gc_slice_us = slice_us;
+	add_pause(&major_record, start);
+	finish_cycle();
+}
+
+static void collect_heap()
+{
+	if(gc_state == GC_SWEEPING) finish_sweeping();
+	int64_t slice_us = gc_slice_us;
+	int64_t start = now_ns();
+	gc_slice_us = 0;
+
+	if(gc_state == GC_IDLE) {
+		int parallel = gc_threads > 1 && live_bytes + allocated_bytes >= PARALLEL_MARK_MIN;
+		start_cycle();
+		if(parallel) mark_in_parallel();
+		else mark_roots();
+	}
+
+	mark_slice(INT64_MAX);
+	finish_marking();
+	add_pause(&major_record, start);
+	gc_slice_us = slice_us;
+}
+
+static MemoryBlock *forwarded(MemoryBlock *block)
+{
+	if(block && block->flags & GC_FORWARDED) return *(MemoryBlock**)(block + 1);
+	return block;
+}
+
+static void move_cell(Page *page, int64_t index)
+{
+	MemoryBlock *block = (MemoryBlock*)(page->cells + index * page->cell_size);
+	MemoryBlock *copy = heap_alloc(page->cell_size);
+	uint32_t flags = copy->flags;
+	memcpy(copy, block, page->cell_size);
+	copy->flags = flags | (block->flags & (GC_VIEW | GC_SITE_MASK));
+	Type *type = block->type && !(block->flags & GC_VIEW) ? block_type(block) : 0;
+
+	if(type && type->kind == TY_STRING) {
+		((String*)copy)->chars = (char*)((String*)copy + 1);
+	}
+	else if(type && type->kind == TY_ARRAY && has_inline_items((Array*)block)) {
+		((Array*)copy)->items = (Array*)copy + 1;
+	}
+
+	block->flags |= GC_FORWARDED;
+	*(MemoryBlock**)(block + 1) = copy;
+	major_record.moved_objects ++;
+	major_record.moved_bytes += page->cell_size;
+}
+
+static void fix_block(MemoryBlock *block)
+{
+	if(!block->type) return;
+	if(block->flags & GC_VIEW) rebase_view(block, forwarded(*view_base(block)));
+	Type *type = block_type(block);
+
+	if(type->kind == TY_MAP) {
+		Map *map = (Map*)block;
+		if(!map->ctrl) return;
+		map->ctrl = (uint8_t*)(forwarded((MemoryBlock*)map->ctrl - 1) + 1);
+		update_slots(map, forwarded);
+		return;
+	}
+
+	if(type->kind != TY_ARRAY) return;
+	Array *array = (Array*)block;
+	if(!(block->flags & GC_VIEW) && !has_inline_items(array)) array->items = forwarded((MemoryBlock*)array->items - 1) + 1;
+	if(!is_gc_ref(type->subtype)) return;
+	MemoryBlock **items = array->items;
+	for(int64_t i=0; i < array->length; i++) items[i] = forwarded(items[i]);
+}
+
+static void fix_page(Page *page)
+{
+	for(int64_t w=0; w < BITMAP_WORDS; w++) {
+		for(uint64_t bits = page->live_bits[w]; bits; bits &= bits - 1) {
+			fix_block((MemoryBlock*)(page->cells + (w * 64 + __builtin_ctzll(bits)) * page->cell_size));
+		}
+	}
+}
+
+static void compact_heap(int64_t threshold)
+{
+	int64_t slice_us = gc_slice_us;
+	int64_t start = now_ns();
+	int64_t total_bytes = 0;
+	int64_t free_bytes = 0;
+	Page *sparse_pages = 0;
+	gc_slice_us = 0;
+	sweep_slice(INT64_MAX);
+	gc_slice_us = slice_us;
+
+	for(Pool *pool = pools; pool < pools + sizeof(pools) / sizeof(Pool); pool++) {
+		for(Page *page = pool->pages; page; page = page->next) {
+			total_bytes += page->num_cells * page->cell_size;
+			free_bytes += (page->num_cells - page->live_cells) * page->cell_size;
+		}
+	}
+
+	if(free_bytes * 100 <= total_bytes * threshold) {
+		add_pause(&major_record, start);
+		finish_cycle();
+		return;
+	}
+
+	for(Pool *pool = pools; pool < pools + sizeof(pools) / sizeof(Pool); pool++) {
+		for(Page **link = &pool->pages; *link;) {
+			Page *page = *link;
+
+			if((page->num_cells - page->live_cells) * 100 > page->num_cells * threshold) {
+				*link = page->next;
+				page->next = sparse_pages;
+				sparse_pages = page;
+			}
+			else {
+				link = &page->next;
+			}
+		}
+
+		pool->alloc_page = pool->pages;
+		pool->full_pages = 0;
+	}
+
+	for(Page *page = sparse_pages; page; page = page->next) {
+		for(int64_t w=0; w < BITMAP_WORDS; w++) {
+			for(uint64_t bits = page->live_bits[w]; bits; bits &= bits - 1) {
+				move_cell(page, w * 64 + __builtin_ctzll(bits));
+			}
+		}
+	}
+
+	for(Mutator *m = mutators; m; m = m->next) {
+		for(Frame *frame = m->cur_frame; frame; frame = frame->parent) {
+			for(int64_t i=0; i < frame->num_gc_decls; i++) frame->gc_objs[i] = forwarded(frame->gc_objs[i]);
+		}
+	}
+
+	for(Pool *pool = pools; pool < pools + sizeof(pools) / sizeof(Pool); pool++) {
+		for(Page *page = pool->pages; page; page = page->next) fix_page(page);
+	}
+
+	for(LargeObject *large = large_objects; large; large = large->next) fix_block(large->block);
+
+	while(sparse_pages) {
+		Page *page = sparse_pages;
+		sparse_pages = page->next;
+		page->next = free_pages;
+		free_pages = page;
+	}
+
+	gc_stats.compactions ++;
+	add_pause(&major_record, start);
+	finish_cycle();
+}
+
+static void request_gc(int64_t major)
+{
+	if(major) __atomic_store_n(&major_gc_pending, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&minor_gc_pending, 1, __ATOMIC_RELAXED);
+}
+
+static int stop_world()
+{
+	int64_t self = mutator && mutator->cur_frame;
+
+	if(world_stopped) {
+		parked_mutators += self;
+		pthread_cond_signal(&world_parked);
+		while(world_stopped) pthread_cond_wait(&world_resumed, &heap_lock);
+		parked_mutators -= self;
+		return 0;
+	}
+
+	if(!__atomic_load_n(&minor_gc_pending, __ATOMIC_RELAXED)) return 0;
+	world_stopped = 1;
+	while(parked_mutators < active_mutators - self) pthread_cond_wait(&world_parked, &heap_lock);
+	return 1;
+}
+
+static void resume_world()
+{
+	world_stopped = 0;
+	pthread_cond_broadcast(&world_resumed);
+}
+
+static void heap_limit_exceeded()
+{
+	fprintf(
+		stderr, "heap limit of %li bytes exceeded: %li bytes are still in use after a full collection\n",
+		gc_max_heap, heap_bytes()
+	);
+
+	exit(1);
+}
+
+// full is set by collect_garbage(), whose caller may hold pointers to old objects in C variables, so that never compacts
+static __attribute__((cold)) void gc_safepoint(int64_t full)
+{
+	int64_t exceeded = 0;
+	pthread_mutex_lock(&heap_lock);
+
+	if(stop_world()) {
+		int64_t shared = active_mutators > 1;
+		collect_nursery();
+
+		int64_t major = __atomic_load_n(&major_gc_pending, __ATOMIC_RELAXED);
+
+		if(gc_emergency) {
+			// the heap went over its limit, so collect all of it, compact the pages that are mostly free and hand the free pages back
+			collect_heap();
+			if(!full) compact_heap(EMERGENCY_COMPACT);
+			else finish_sweeping();
+			release_idle_pages();
+			gc_stats.emergency_collections ++;
+			gc_emergency = 0;
+			exceeded = heap_bytes() > gc_max_heap;
+		}
+		else if(full || major || (shared && gc_state != GC_IDLE)) {
+			if(full || shared || !gc_incremental) {
+				collect_heap();
+				if(gc_compact && !full) compact_heap(gc_compact);
+				else if(shared) finish_sweeping();
+			}
+			else if(gc_state == GC_IDLE) {
+				int64_t start = now_ns();
+				start_cycle();
+				mark_roots();
+				add_pause(&major_record, start);
+			}
+		}
+
+		// the other threads stay stopped while the program exits
+		if(!exceeded) resume_world();
+	}
+
+	pthread_mutex_unlock(&heap_lock);
+	if(exceeded) heap_limit_exceeded();
+}
+
+static __attribute__((cold)) void step_gc()
+{
+	pthread_mutex_lock(&heap_lock);
+	if(active_mutators > 1) request_gc(0);
+	else gc_step();
+	pthread_mutex_unlock(&heap_lock);
+}
+
+void collect_garbage()
+{
+	request_gc(1);
+	gc_safepoint(1);
+}
+
+void attach_thread()
+{
+	if(mutator) return;
+	Mutator *m = check_alloc(calloc(1, sizeof(Mutator)));
+	pthread_mutex_lock(&heap_lock);
+	if(!gc_initialized) init_gc();
+
+	for(int64_t i=0; nursery_size > 0 && i < MAX_NURSERIES; i++) {
+		if(!nursery_used[i]) {
+			nursery_used[i] = 1;
+			m->nursery = young_space + i * nursery_size;
+			m->nursery_top = m->nursery;
+			m->nursery_end = m->nursery + nursery_size;
+			break;
+		}
+	}
+
+	m->cur_task = &m->root_task;
+	m->next = mutators;
+	mutators = m;
+	pthread_mutex_unlock(&heap_lock);
+	mutator = m;
+}
+
+void detach_thread()
+{
+	if(!mutator) return;
+	flush_output();
+	pthread_mutex_lock(&heap_lock);
+	fold_alloc_stats(mutator);
+	mutator->detached = 1;
+	pthread_mutex_unlock(&heap_lock);
+	mutator = 0;
+}
+
+static Mutator *current_mutator()
+{
+	if(__builtin_expect(!mutator, 0)) attach_thread();
+	return mutator;
+}
+
+static Mutator *enter_runtime()
+{
+	Mutator *m = current_mutator();
+	pthread_mutex_lock(&heap_lock);
+	while(world_stopped) pthread_cond_wait(&world_resumed, &heap_lock);
+	active_mutators ++;
+	pthread_mutex_unlock(&heap_lock);
+	return m;
+}
+
+static void leave_runtime()
+{
+	pthread_mutex_lock(&heap_lock);
+	active_mutators --;
+	pthread_cond_signal(&world_parked);
+	pthread_mutex_unlock(&heap_lock);
+}
+
+RUNTIME_INLINE void push_frame(void *frame)
+{
+	Mutator *m = mutator;
+	if(__builtin_expect(!m || !m->cur_frame, 0)) m = enter_runtime();
+	m->cur_frame = frame;
+	if(__builtin_expect(__atomic_load_n(&minor_gc_pending, __ATOMIC_RELAXED), 0)) gc_safepoint(0);
+}
+
+RUNTIME_INLINE void pop_frame()
+{
+	Mutator *m = mutator;
+	if(m->cur_frame == m->frame_watermark) m->frame_watermark = m->cur_frame->parent;
+	if(__builtin_expect(m->cur_frame == m->prof_anchor, 0)) {
+		m->prof_anchor = m->cur_frame->parent;
+		m->prof_anchor_depth --;
+	}
+	m->cur_frame = m->cur_frame->parent;
+	if(__builtin_expect(!m->cur_frame, 0)) leave_runtime();
+	else if(__builtin_expect(__atomic_load_n(&minor_gc_pending, __ATOMIC_RELAXED), 0)) gc_safepoint(0);
+}
+
+RUNTIME_INLINE void *get_cur_frame()
+{
+	return mutator ? mutator->cur_frame : 0;
+}
+
+void get_gc_stats(GcStats *stats)
+{
+	pthread_mutex_lock(&heap_lock);
+	if(mutator) fold_alloc_stats(mutator);
+	*stats = gc_stats;
+	stats->heap_bytes = heap_bytes();
+	pthread_mutex_unlock(&heap_lock);
+}
+
+void write_gc_stats(FILE *fs)
+{
+	GcStats stats;
+	get_gc_stats(&stats);
+	fprintf(fs, "{\n");
+
+	#define _(name) fprintf(fs, "\t\"%s\": %li,\n", #name, stats.name);
+	_(minor_collections) _(major_collections) _(pause_ns) _(max_pause_ns) _(frames_scanned)
+	_(promoted_objects) _(promoted_bytes) _(marked_objects) _(marked_bytes) _(swept_objects) _(swept_bytes)
+	_(compactions) _(emergency_collections) _(moved_objects) _(moved_bytes)
+	_(strings) _(string_bytes) _(arrays) _(array_bytes) _(concats) _(concat_bytes) _(views) _(view_bytes)
+	_(heap_bytes) _(peak_heap_bytes)
+	#undef _
+
+	fprintf(fs, "\t\"collections\": [");
+
+	for(int64_t i=0; i < gc_record_count; i++) {
+		GcRecord *record = &gc_records[i];
+		fprintf(fs, "%s\n\t\t{\"kind\": \"%s\"", i > 0 ? "," : "", record->major ? "major" : "minor");
+
+		#define _(name) fprintf(fs, ", \"%s\": %li", #name, record->name);
+		_(start_ns) _(pause_ns) _(max_pause_ns) _(pauses) _(frames_scanned)
+		#undef _
+
+		fprintf(fs, ", \"%s_objects\": %li", record->major ? "marked" : "promoted", record->objects);
+		fprintf(fs, ", \"%s_bytes\": %li", record->major ? "marked" : "promoted", record->bytes);
+		if(record->major) fprintf(fs, ", \"swept_objects\": %li, \"swept_bytes\": %li", record->swept_objects, record->swept_bytes);
+		if(record->moved_objects) fprintf(fs, ", \"moved_objects\": %li, \"moved_bytes\": %li", record->moved_objects, record->moved_bytes);
+		fprintf(fs, "}");
+	}
+
+	fprintf(fs, "%s]\n}\n", gc_record_count > 0 ? "\n\t" : "");
+}
+
+static int compare_sites(const void *a, const void *b)
+{
+	const SiteStats *x = a;
+	const SiteStats *y = b;
+	if(x->peak_live_bytes != y->peak_live_bytes) return x->peak_live_bytes < y->peak_live_bytes ? 1 : -1;
+	if(x->bytes != y->bytes) return x->bytes < y->bytes ? 1 : -1;
+	return x->id < y->id ? -1 : x->id > y->id;
+}
+
+static void report_alloc_sites()
+{
+	FILE *fs = site_report_path ? fopen(site_report_path, "w") : stderr;
+
+	if(!fs) {
+		fprintf(stderr, "could not write allocation sites to %s\n", site_report_path);
+		return;
+	}
+
+	SiteStats *ranked = check_alloc(malloc(sizeof(SiteStats) * site_count));
+	memcpy(ranked, site_stats, sizeof(SiteStats) * site_count);
+	qsort(ranked, site_count, sizeof(SiteStats), compare_sites);
+	fprintf(fs, "# allocation sites by peak bytes live after a major collection%s\n", site_censuses ? "" : ", none ran so by bytes");
+	fprintf(fs, "%15s %15s %15s %10s  %s\n", "peak_live_bytes", "live_bytes", "bytes", "allocs", "site");
+
+	for(int64_t i=0; i < site_count; i++) {
+		SiteStats *stats = &ranked[i];
+		if(stats->allocs == 0) continue;
+		// without a major collection there was no census, so the live columns are unknown rather than 0
+		if(site_censuses) fprintf(fs, "%15li %15li ", stats->peak_live_bytes, stats->live_bytes);
+		else fprintf(fs, "%15s %15s ", "n/a", "n/a");
+		fprintf(fs, "%15li %10li  ", stats->bytes, stats->allocs);
+		if(stats->id == 0) fprintf(fs, "<runtime>\n");
+		else fprintf(fs, "%s:%li %s\n", site_table[stats->id - 1].file, site_table[stats->id - 1].line, site_table[stats->id - 1].kind);
+	}
+
+	free(ranked);
+	if(fs != stderr) fclose(fs);
+}
+
+void register_alloc_sites(AllocSite *sites)
+{
+	site_table = sites;
+	site_count = 1;
+	while(sites[site_count - 1].file && site_count <= GC_SITE_MASK >> GC_SITE_SHIFT) site_count ++;
+	site_stats = check_alloc(calloc(site_count, sizeof(SiteStats)));
+	for(int64_t i=0; i < site_count; i++) site_stats[i].id = i;
+	site_report_path = getenv("CRUNCHY_GC_SITES");
+	if(site_report_path && !*site_report_path) site_report_path = 0;
+	atexit(report_alloc_sites);
+}
+
+static void count_prof_stack(FrameInfo **frames, int64_t depth, uint64_t hash)
+{
+	for(int64_t i=0; i < PROF_STACKS; i++) {
+		ProfStack *stack = &prof_stacks[(hash + i) & (PROF_STACKS - 1)];
+
+		if(stack->count == 0) {
+			stack->hash = hash;
+			stack->depth = depth;
+			for(int64_t j=0; j < depth; j++) stack->frames[j] = frames[j];
+			stack->count = 1;
+			return;
+		}
+
+		if(stack->hash == hash && stack->depth == depth) {
+			int64_t j = 0;
+			while(j < depth && stack->frames[j] == frames[j]) j ++;
+
+			if(j == depth) {
+				stack->count ++;
+				return;
+			}
+		}
+	}
+
+	prof_dropped ++;
+}
+
+static void prof_tick(int signum)
+{
+	Mutator *m = mutator;
+	FrameInfo *walked[PROF_DEPTH];
+	FrameInfo *frames[PROF_DEPTH];
+	int64_t count = 0;
+	int64_t depth = 0;
+	uint64_t hash = 14695981039346656037ull;
+	Frame *frame = m ? m->cur_frame : 0;
+
+	// the frames from the anchor to main were walked by an earlier sample and pop_frame keeps the anchor on the stack,
+	// so a deep stack is only walked down to the anchor
+	for(; frame; frame = frame->parent) {
+		if(frame == m->prof_anchor && m->prof_anchor_depth > PROF_DEPTH) break;
+		walked[count ++ % PROF_DEPTH] = frame->info;
+	}
+
+	if(frame) {
+		count += m->prof_anchor_depth;
+	}
+	else if(count > PROF_DEPTH) {
+		for(int64_t i=0; i < PROF_DEPTH - 1; i++) m->prof_outer[i] = walked[(count - PROF_DEPTH + 1 + i) % PROF_DEPTH];
+	}
+
+	// a deep stack keeps its outermost frames, so it still shares the prefix from main with shallower stacks
+	if(count > PROF_DEPTH) {
+		m->prof_anchor = m->cur_frame;
+		m->prof_anchor_depth = count;
+		frames[depth ++] = &prof_truncated;
+		for(int64_t i=0; i < PROF_DEPTH - 1; i++) frames[depth ++] = m->prof_outer[i];
+	}
+	else {
+		for(int64_t i=0; i < count; i++) frames[depth ++] = walked[i];
+	}
+
+	for(int64_t i=0; i < depth; i++) {
+		hash = (hash ^ (uintptr_t)frames[i]) * 1099511628211ull;
+	}
+
+	while(__atomic_exchange_n(&prof_lock, 1, __ATOMIC_ACQUIRE));
+	count_prof_stack(frames, depth, hash);
+	__atomic_store_n(&prof_lock, 0, __ATOMIC_RELEASE);
+}
+
+static void report_profile()
+{
+	struct itimerval stop = {};
+	setitimer(ITIMER_PROF, &stop, 0);
+	FILE *fs = strcmp(prof_path, "1") == 0 ? stderr : fopen(prof_path, "w");
+
+	if(!fs) {
+		fprintf(stderr, "could not write profile to %s\n", prof_path);
+		return;
+	}
+
+	for(int64_t i=0; i < PROF_STACKS; i++) {
+		ProfStack *stack = &prof_stacks[i];
+		if(stack->count == 0) continue;
+		if(stack->depth == 0) fprintf(fs, "<runtime>");
+
+		for(int64_t j = stack->depth - 1; j >= 0; j--) {
+			FrameInfo *info = stack->frames[j];
+			if(info == &prof_truncated) fprintf(fs, "%s", info->name);
+			else if(info) fprintf(fs, "%s (%s:%li)", info->name, info->file, info->line);
+			else fprintf(fs, "<native>");
+			if(j > 0) fprintf(fs, ";");
+		}
+
+		fprintf(fs, " %li\n", stack->count);
+	}
+
+	if(prof_dropped) fprintf(fs, "<dropped> %li\n", prof_dropped);
+	if(fs != stderr) fclose(fs);
+}
+
+static void __attribute__((constructor)) start_profiler()
+{
+	prof_path = getenv("CRUNCHY_PROF");
+	if(!prof_path || !*prof_path) return;
+	int64_t hz = env_int("CRUNCHY_PROF_HZ", 99);
+	if(hz < 1 || hz > 1000000) hz = 99;
+	prof_stacks = check_alloc(calloc(PROF_STACKS, sizeof(ProfStack)));
+	struct sigaction action = {.sa_handler = prof_tick, .sa_flags = SA_RESTART};
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGPROF, &action, 0);
+	struct itimerval timer = {{0, 1000000 / hz}, {0, 1000000 / hz}};
+	setitimer(ITIMER_PROF, &timer, 0);
+	atexit(report_profile);
+}
+
+static int task_push(TaskDeque *deque, Task *task)
+{
+	int64_t bottom = deque->bottom;
+	int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	if(bottom - top >= TASK_DEQUE_SIZE) return 0;
+	__atomic_store_n(&deque->tasks[bottom & (TASK_DEQUE_SIZE - 1)], task, __ATOMIC_RELAXED);
+	__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static Task *task_pop(TaskDeque *deque)
+{
+	int64_t bottom = deque->bottom - 1;
+	__atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+	if(top > bottom) {
+		__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	Task *task = __atomic_load_n(&deque->tasks[bottom & (TASK_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+	if(top < bottom) return task;
+	int won = __atomic_compare_exchange_n(&deque->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+	__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+	return won ? task : 0;
+}
+
+static Task *task_steal(TaskDeque *deque)
+{
+	int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+	if(top >= bottom) return 0;
+	Task *task = __atomic_load_n(&deque->tasks[top & (TASK_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+	if(!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return 0;
+	return task;
+}
+
+static int has_tasks()
+{
+	if(__atomic_load_n(&injected_count, __ATOMIC_SEQ_CST)) return 1;
+
+	for(int64_t i=0; i < task_threads; i++) {
+		TaskDeque *deque = &task_deques[i];
+		if(__atomic_load_n(&deque->bottom, __ATOMIC_SEQ_CST) > __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST)) return 1;
+	}
+
+	return 0;
+}
+
+static Task *find_task()
+{
+	Task *task = own_deque ? task_pop(own_deque) : 0;
+	if(task) return task;
+
+	if(__atomic_load_n(&injected_count, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&task_lock);
+		task = injected_tasks;
+
+		if(task) {
+			injected_tasks = task->next;
+			__atomic_store_n(&injected_count, injected_count - 1, __ATOMIC_RELEASE);
+		}
+
+		pthread_mutex_unlock(&task_lock);
+		if(task) return task;
+	}
+
+	int64_t first = own_deque ? own_deque - task_deques + 1 : 0;
+
+	for(int64_t i=0; i < task_threads && !task; i++) {
+		task = task_steal(&task_deques[(first + i) % task_threads]);
+	}
+
+	return task;
+}
+
+static void wake_sleepers()
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if(__atomic_load_n(&task_sleepers, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&task_lock);
+		pthread_cond_broadcast(&task_wake);
+		pthread_mutex_unlock(&task_lock);
+	}
+}
+
+static int64_t park_mutator()
+{
+	// a thread that blocks with frames on its stack counts as parked, so collections need not wait for it
+	if(!mutator || !mutator->cur_frame) return 0;
+	pthread_mutex_lock(&heap_lock);
+	parked_mutators ++;
+	pthread_cond_signal(&world_parked);
+	pthread_mutex_unlock(&heap_lock);
+	return 1;
+}
+
+static void unpark_mutator(int64_t parked)
+{
+	if(!parked) return;
+	pthread_mutex_lock(&heap_lock);
+	while(world_stopped) pthread_cond_wait(&world_resumed, &heap_lock);
+	parked_mutators --;
+	pthread_mutex_unlock(&heap_lock);
+}
+
+static void sleep_for_tasks(Task *group)
+{
+	int64_t parked = park_mutator();
+	pthread_mutex_lock(&task_lock);
+	__atomic_fetch_add(&task_sleepers, 1, __ATOMIC_SEQ_CST);
+
+	if(!has_tasks() && (!group || __atomic_load_n(&group->pending, __ATOMIC_SEQ_CST) > 0))
+		pthread_cond_wait(&task_wake, &task_lock);
+
+	__atomic_fetch_sub(&task_sleepers, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&task_lock);
+	unpark_mutator(parked);
+}
+
+static void run_task(Task *task)
+{
+	Mutator *m = current_mutator();
+	Task *outer = m->cur_task;
+	m->cur_task = task;
+	m->task_depth ++;
+	task->function();
+	wait_tasks();
+	m->task_depth --;
+	m->cur_task = outer;
+	flush_output();
+	Task *parent = task->parent;
+	free(task);
+	if(__atomic_sub_fetch(&parent->pending, 1, __ATOMIC_ACQ_REL) == 0) wake_sleepers();
+}
+
+static void *task_worker(void *arg)
+{
+	own_deque = arg;
+	attach_thread();
+
+	while(1) {
+		Task *task = find_task();
+		if(task) run_task(task);
+		else sleep_for_tasks(0);
+	}
+
+	return 0;
+}
+
+static void start_workers()
+{
+	pthread_mutex_lock(&task_lock);
+
+	if(!workers_started) {
+		int64_t threads = env_int("CRUNCHY_TASK_THREADS", sysconf(_SC_NPROCESSORS_ONLN));
+		if(threads < 1) threads = 1;
+		task_deques = check_alloc(calloc(threads, sizeof(TaskDeque)));
+		task_threads = threads;
+
+		for(int64_t i=0; i < threads; i++) {
+			pthread_t thread;
+			pthread_attr_t attr;
+			pthread_attr_init(&attr);
+			pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+			int failed = pthread_create(&thread, &attr, task_worker, &task_deques[i]);
+			pthread_attr_destroy(&attr);
+			if(failed) break;
+		}
+
+		__atomic_store_n(&workers_started, 1, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&task_lock);
+}
+
+void spawn_task(Function function)
+{
+	Mutator *m = current_mutator();
+	if(!__atomic_load_n(&workers_started, __ATOMIC_ACQUIRE)) start_workers();
+	flush_output();
+	Task *task = check_alloc(malloc(sizeof(Task)));
+	task->function = function;
+	task->parent = m->cur_task;
+	task->pending = 0;
+	__atomic_fetch_add(&task->parent->pending, 1, __ATOMIC_RELAXED);
+
+	if(!own_deque || !task_push(own_deque, task)) {
+		pthread_mutex_lock(&task_lock);
+		task->next = 0;
+		if(injected_tasks) last_injected_task->next = task;
+		else injected_tasks = task;
+		last_injected_task = task;
+		__atomic_store_n(&injected_count, injected_count + 1, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&task_lock);
+	}
+
+	wake_sleepers();
+}
+
+void wait_tasks()
+{
+	Mutator *m = current_mutator();
+	Task *group = m->cur_task;
+
+	while(__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0) {
+		Task *task = m->task_depth < MAX_TASK_DEPTH ? find_task() : 0;
+		if(task) run_task(task);
+		else sleep_for_tasks(group);
+	}
+}
+
+static void count_heap_alloc(int64_t size)
+{
+	if(live_bytes + allocated_bytes + size > heap_goal) request_gc(1);
+
+	if(gc_max_heap && !gc_emergency && heap_bytes() + size > gc_max_heap) {
+		gc_emergency = 1;
+		request_gc(1);
+	}
+
+	allocated_bytes += size;
+	update_peak_heap();
+}
+
+static int64_t count_site(int64_t site, int64_t size)
+{
+	if(!site_stats || site < 0 || site >= site_count) return 0;
+	__atomic_fetch_add(&site_stats[site].allocs, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&site_stats[site].bytes, size, __ATOMIC_RELAXED);
+	return site << GC_SITE_SHIFT;
+}
+
+static __attribute__((noinline)) void *heap_alloc_block(Type *type, int64_t size, int64_t site)
+{
+	if(((size + 7) & ~7) <= nursery_size) request_gc(0);
+	uint32_t type_id = type ? type_index(type) : 0;
+	pthread_mutex_lock(&heap_lock);
+	count_heap_alloc(size);
+	MemoryBlock *block = heap_alloc(size);
+	pthread_mutex_unlock(&heap_lock);
+	block->type = type_id;
+	block->flags |= count_site(site, size);
+	return block;
+}
+
+void *new_memory_block(Type *type, int64_t size, int64_t site)
+{
+	Mutator *m = current_mutator();
+	if(__builtin_expect(gc_state != GC_IDLE, 0)) step_gc();
+	m->allocs_since_gc ++;
+	if(__builtin_expect(gc_every != 0, 0) && m->allocs_since_gc >= gc_every) request_gc(1);
+	int64_t young_size = (size + 7) & ~7;
+	if(__builtin_expect(young_size > m->nursery_end - m->nursery_top, 0)) return heap_alloc_block(type, size, site);
+	MemoryBlock *block = (void*)m->nursery_top;
+	__atomic_store_n(&m->nursery_top, m->nursery_top + young_size, __ATOMIC_RELAXED);
+	block->type = type ? type_index(type) : 0;
+	block->flags = count_site(site, size);
+	return block;
+}
+
+RUNTIME_INLINE String *new_string_at(int64_t site, int64_t length, char *chars)
+{
+	int64_t size = sizeof(String) + length + 1;
+	String *string = new_memory_block(&t_string, size, site);
+	mutator->stats.strings ++;
+	mutator->stats.string_bytes += size;
+	string->length = length;
+	string->chars = (char*)(string + 1);
+	memcpy(string->chars, chars, length);
+	string->chars[length] = 0;
+	//printf("## created %s %p \n", string->chars, string);
+	return string;
+}
+
+RUNTIME_INLINE String *new_string(int64_t length, char *chars)
+{
+	return new_string_at(0, length, chars);
+}
+
+static Array *alloc_array(Type *type, int64_t length, int64_t site)
+{
+	int64_t size = sizeof(Array) + length * item_size(type->subtype);
+	Array *array = new_memory_block(type, size, site);
+	mutator->stats.arrays ++;
+	mutator->stats.array_bytes += size;
+	array->length = length;
+	array->capacity = length;
+	array->items = array + 1;
+	return array;
+}
+
+static void set_item(Array *array, int64_t index, Type *type, va_list *args)
+{
+	switch(type->kind) {
+		case TY_INT:
+			((int64_t*)array->items)[index] = va_arg(*args, int64_t);
+			break;
+		case TY_BOOL:
+			((uint8_t*)array->items)[index] = va_arg(*args, int);
+			break;
+		case TY_FUNC:
+			((Function*)array->items)[index] = va_arg(*args, Function);
+			break;
+		default: {
+			MemoryBlock *value = va_arg(*args, MemoryBlock*);
+			((MemoryBlock**)array->items)[index] = value;
+			write_barrier(&array->block, value);
+		} break;
+	}
+}
+
+static Array *fill_array(Array *array, va_list *args)
+{
+	Type *type = block_type(&array->block)->subtype;
+	for(int64_t i=0; i < array->length; i++) set_item(array, i, type, args);
+	//printf("## created array with %li elms %p \n", array->length, array);
+	return array;
+}
+
+Array *new_array(Type *type, int64_t length, ...)
+{
+	va_list args;
+	va_start(args, length);
+	Array *array = fill_array(alloc_array(type, length, 0), &args);
+	va_end(args);
+	return array;
+}
+
+Array *new_array_at(int64_t site, Type *type, int64_t length, ...)
+{
+	va_list args;
+	va_start(args, length);
+	Array *array = fill_array(alloc_array(type, length, site), &args);
+	va_end(args);
+	return array;
+}
+
+static void *new_items(MemoryBlock *owner, int64_t size)
+{
+	if(is_young(owner)) return (MemoryBlock*)new_memory_block(0, sizeof(MemoryBlock) + size, block_site(owner)) + 1;
+	pthread_mutex_lock(&heap_lock);
+	count_heap_alloc(sizeof(MemoryBlock) + size);
+	void *items = new_buffer(size);
+	pthread_mutex_unlock(&heap_lock);
+	((MemoryBlock*)items - 1)->flags |= count_site(block_site(owner), sizeof(MemoryBlock) + size);
+	return items;
+}
+
+static void grow_array(Array *array, int64_t itemsize)
+{
+	int64_t capacity = array->capacity < 4 ? 4 : array->capacity * 2;
+	void *items = new_items(&array->block, capacity * itemsize);
+
+	memcpy(items, array->items, array->length * itemsize);
+	array->items = items;
+	array->capacity = capacity;
+
+	if(array->block.flags & GC_VIEW) {
+		array->block.flags &= ~GC_VIEW;
+
+		if(has_ref_items(&array->block)) {
+			MemoryBlock **refs = items;
+			for(int64_t i=0; i < array->length; i++) write_barrier(&array->block, refs[i]);
+		}
+	}
+}
+
+void array_push(Array *array, ...)
+{
+	Type *type = block_type(&array->block)->subtype;
+	if(array->length == array->capacity) grow_array(array, item_size(type));
+	va_list args;
+	va_start(args, array);
+	set_item(array, array->length, type, &args);
+	va_end(args);
+	array->length ++;
+}
+
+void flush_output()
+{
+	if(!mutator) return;
+	fwrite(mutator->out_buffer, 1, mutator->out_length, stdout);
+	fflush(stdout);
+	mutator->out_length = 0;
+}
+
+static Mutator *reserve_output(int64_t length)
+{
+	Mutator *m = current_mutator();
+	if(m->out_length + length > OUT_BUFFER_SIZE) flush_output();
+	return m;
+}
+
+void print_chars(char *chars, int64_t length)
+{
+	Mutator *m = reserve_output(length);
+
+	if(length > OUT_BUFFER_SIZE) {
+		fwrite(chars, 1, length, stdout);
+		return;
+	}
+
+	memcpy(m->out_buffer + m->out_length, chars, length);
+	m->out_length += length;
+}
+
+void print_int(int64_t value)
+{
+	static const char digit_pairs[] =
+		"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+		"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+
+	char digits[20];
+	char *end = digits + sizeof(digits);
+	char *start = end;
+	uint64_t magnitude = value < 0 ? -(uint64_t)value : value;
+
+	while(magnitude >= 100) {
+		start -= 2;
+		memcpy(start, digit_pairs + magnitude % 100 * 2, 2);
+		magnitude /= 100;
+	}
+
+	if(magnitude >= 10) {
+		start -= 2;
+		memcpy(start, digit_pairs + magnitude * 2, 2);
+	}
+	else {
+		*--start = '0' + magnitude;
+	}
+
+	Mutator *m = reserve_output(end - start + 1);
+	if(value < 0) m->out_buffer[m->out_length ++] = '-';
+	memcpy(m->out_buffer + m->out_length, start, end - start);
+	m->out_length += end - start;
+}
+
+void print_bool(int64_t value)
+{
+	if(value) print_chars("true", 4);
+	else print_chars("false", 5);
+}
+
+void print_newline()
+{
+	print_chars("\n", 1);
+	if(out_line_flush) flush_output();
+}
+
+void print_string(String *str)
+{
+	print_chars(str->chars, str->length);
+}
+
+void print_array(Array *array, Type *type)
+{
+	print_chars("[", 1);
+
+	for(int64_t i=0; i < array->length; i++) {
+		if(i > 0) print_chars(", ", 2);
+
+		switch(type->subtype->kind) {
+			case TY_INT:
+				print_int(((int64_t*)array->items)[i]);
+				break;
+			case TY_BOOL:
+				print_bool(((uint8_t*)array->items)[i]);
+				break;
+			case TY_STRING:
+				print_string(((String**)array->items)[i]);
+				break;
+			case TY_FUNC:
+				print_chars("<Function>", 10);
+				break;
+			case TY_ARRAY:
+				print_array(((Array**)array->items)[i], type->subtype);
+				break;
+		}
+	}
+
+	print_chars("]", 1);
+}
+
+String *concat_strings_at(int64_t site, String *left, String *right)
+{
+	if(!left->length) return right;
+	if(!right->length) return left;
+	int64_t length = left->length + right->length;
+	int64_t size = sizeof(String) + length + 1;
+	String *string = new_memory_block(&t_string, size, site);
+	mutator->stats.concats ++;
+	mutator->stats.concat_bytes += size;
+	string->length = length;
+	string->chars = (char*)(string + 1);
+	memcpy(string->chars, left->chars, left->length);
+	memcpy(string->chars + left->length, right->chars, right->length);
+	string->chars[length] = 0;
+	//printf("## concated %s\n", string->chars);
+	return string;
+}
+
+String *concat_strings(String *left, String *right)
+{
+	return concat_strings_at(0, left, right);
+}
+
+static String *concat_list(int64_t site, int64_t count, va_list *args)
+{
+	String *pieces[count];
+	String *filled = 0;
+	int64_t num_filled = 0;
+	int64_t length = 0;
+
+	for(int64_t i=0; i < count; i++) {
+		pieces[i] = va_arg(*args, String*);
+		length += pieces[i]->length;
+
+		if(pieces[i]->length) {
+			filled = pieces[i];
+			num_filled ++;
+		}
+	}
+
+	// strings are immutable, so a single non-empty piece is the result itself
+	if(num_filled < 2) return filled ? filled : pieces[0];
+	int64_t size = sizeof(String) + length + 1;
+	String *string = new_memory_block(&t_string, size, site);
+	mutator->stats.concats ++;
+	mutator->stats.concat_bytes += size;
+	string->length = length;
+	string->chars = (char*)(string + 1);
+	char *chars = string->chars;
+
+	for(int64_t i=0; i < count; i++) {
+		memcpy(chars, pieces[i]->chars, pieces[i]->length);
+		chars += pieces[i]->length;
+	}
+
+	*chars = 0;
+	return string;
+}
+
+String *concat_many(int64_t count, ...)
+{
+	va_list args;
+	va_start(args, count);
+	String *string = concat_list(0, count, &args);
+	va_end(args);
+	return string;
+}
+
+String *concat_many_at(int64_t site, int64_t count, ...)
+{
+	va_list args;
+	va_start(args, count);
+	String *string = concat_list(site, count, &args);
+	va_end(args);
+	return string;
+}
+
+static void clamp_range(int64_t length, int64_t *start, int64_t *end)
+{
+	if(*end > length) *end = length;
+	if(*end < 0) *end = 0;
+	if(*start > *end) *start = *end;
+	if(*start < 0) *start = 0;
+}
+
+static void *new_view(Type *type, int64_t size, MemoryBlock *base)
+{
+	MemoryBlock *view = new_memory_block(type, size, 0);
+	view->flags |= GC_VIEW;
+	*view_base(view) = base;
+	if(!is_young(view) && (is_young(base) || has_ref_items(view))) remember(view);
+
+	if(gc_state == GC_MARKING && !is_young(view)) {
+		pthread_mutex_lock(&heap_lock);
+		mark_base(base);
+		pthread_mutex_unlock(&heap_lock);
+	}
+
+	mutator->stats.views ++;
+	return view;
+}
+
+String *slice_string(String *string, int64_t start, int64_t end)
+{
+	clamp_range(string->length, &start, &end);
+	int64_t length = end - start;
+	if(length < VIEW_MIN) return new_string(length, string->chars + start);
+	MemoryBlock *base = string->block.flags & GC_VIEW ? *view_base(&string->block) : &string->block;
+	String *view = new_view(&t_string, sizeof(StringView), base);
+	mutator->stats.view_bytes += length;
+	view->length = length;
+	view->chars = string->chars + start;
+	return view;
+}
+
+Array *slice_array(Array *array, int64_t start, int64_t end)
+{
+	Type *type = block_type(&array->block);
+	int64_t itemsize = item_size(type->subtype);
+	clamp_range(array->length, &start, &end);
+	int64_t length = end - start;
+	char *items = (char*)array->items + start * itemsize;
+
+	if(length * itemsize < VIEW_MIN) {
+		Array *copy = alloc_array(type, length, 0);
+		memcpy(copy->items, items, length * itemsize);
+
+		if(is_gc_ref(type->subtype)) {
+			MemoryBlock **refs = copy->items;
+			for(int64_t i=0; i < length; i++) write_barrier(&copy->block, refs[i]);
+		}
+
+		return copy;
+	}
+
+	MemoryBlock *base =
+		array->block.flags & GC_VIEW ? *view_base(&array->block) :
+		has_inline_items(array) ? &array->block :
+		(MemoryBlock*)array->items - 1;
+
+	Array *view = new_view(type, sizeof(ArrayView), base);
+	mutator->stats.view_bytes += length * itemsize;
+	view->length = length;
+	view->capacity = length;
+	view->items = items;
+	return view;
+}
+
+static int64_t sum_ints(void *items, int64_t length, int64_t value)
+{
+	int64_t *ints = items;
+	int64_t sum = 0;
+	for(int64_t i=0; i < length; i++) sum += ints[i];
+	return sum;
+}
+
+static int64_t extreme_ints(void *items, int64_t length, int64_t max)
+{
+	int64_t *ints = items;
+	int64_t result = ints[0];
+
+	for(int64_t i=1; i < length; i++) {
+		if(max ? ints[i] > result : ints[i] < result) result = ints[i];
+	}
+
+	return result;
+}
+
+static int64_t count_ints(void *items, int64_t length, int64_t value)
+{
+	int64_t *ints = items;
+	int64_t count = 0;
+	for(int64_t i=0; i < length; i++) count += ints[i] == value;
+	return count;
+}
+
+static int64_t find_ints(void *items, int64_t length, int64_t value)
+{
+	int64_t *ints = items;
+
+	for(int64_t i=0; i < length; i++) {
+		if(ints[i] == value) return i;
+	}
+
+	return -1;
+}
+
+static int64_t count_bytes(void *items, int64_t length, int64_t value)
+{
+	uint8_t *bytes = items;
+	int64_t count = 0;
+	for(int64_t i=0; i < length; i++) count += bytes[i] == value;
+	return count;
+}
+
+static int64_t find_bytes(void *items, int64_t length, int64_t value)
+{
+	uint8_t *found = memchr(items, value, length);
+	return found ? found - (uint8_t*)items : -1;
+}
+
+#ifdef __x86_64__
+__attribute__((target("sse4.2")))
+static int64_t sum_ints_sse(void *items, int64_t length, int64_t value)
+{
+	int64_t *ints = items;
+	__m128i sum0 = _mm_setzero_si128(), sum1 = sum0;
+	int64_t i = 0;
+
+	for(; i + 4 <= length; i += 4) {
+		sum0 = _mm_add_epi64(sum0, _mm_loadu_si128((__m128i*)(ints + i)));
+		sum1 = _mm_add_epi64(sum1, _mm_loadu_si128((__m128i*)(ints + i + 2)));
+	}
+
+	int64_t lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(sum0, sum1));
+	return lanes[0] + lanes[1] + sum_ints(ints + i, length - i, 0);
+}
+
+__attribute__((target("sse4.2")))
+static int64_t extreme_ints_sse(void *items, int64_t length, int64_t max)
+{
+	int64_t *ints = items;
+	__m128i result0 = _mm_set1_epi64x(ints[0]), result1 = result0;
+	int64_t i = 0;
+
+	for(; i + 4 <= length; i += 4) {
+		__m128i chunk0 = _mm_loadu_si128((__m128i*)(ints + i));
+		__m128i chunk1 = _mm_loadu_si128((__m128i*)(ints + i + 2));
+		__m128i take0 = max ? _mm_cmpgt_epi64(chunk0, result0) : _mm_cmpgt_epi64(result0, chunk0);
+		__m128i take1 = max ? _mm_cmpgt_epi64(chunk1, result1) : _mm_cmpgt_epi64(result1, chunk1);
+		result0 = _mm_blendv_epi8(result0, chunk0, take0);
+		result1 = _mm_blendv_epi8(result1, chunk1, take1);
+	}
+
+	int64_t lanes[5];
+	_mm_storeu_si128((__m128i*)lanes, result0);
+	_mm_storeu_si128((__m128i*)(lanes + 2), result1);
+	lanes[4] = i < length ? extreme_ints(ints + i, length - i, max) : lanes[0];
+	return extreme_ints(lanes, 5, max);
+}
+
+__attribute__((target("sse4.2")))
+static int64_t count_ints_sse(void *items, int64_t length, int64_t value)
+{
+	int64_t *ints = items;
+	__m128i needle = _mm_set1_epi64x(value);
+	__m128i count = _mm_setzero_si128();
+	int64_t i = 0;
+
+	for(; i + 2 <= length; i += 2) {
+		count = _mm_sub_epi64(count, _mm_cmpeq_epi64(_mm_loadu_si128((__m128i*)(ints + i)), needle));
+	}
+
+	int64_t lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, count);
+	return lanes[0] + lanes[1] + count_ints(ints + i, length - i, value);
+}
+
+__attribute__((target("sse4.2")))
+static int64_t find_ints_sse(void *items, int64_t length, int64_t value)
+{
+	int64_t *ints = items;
+	__m128i needle = _mm_set1_epi64x(value);
+	int64_t i = 0;
+
+	for(; i + 2 <= length; i += 2) {
+		__m128i found = _mm_cmpeq_epi64(_mm_loadu_si128((__m128i*)(ints + i)), needle);
+		int mask = _mm_movemask_pd(_mm_castsi128_pd(found));
+		if(mask) return i + __builtin_ctz(mask);
+	}
+
+	return i < length && ints[i] == value ? i : -1;
+}
+
+__attribute__((target("sse4.2,popcnt")))
+static int64_t count_bytes_sse(void *items, int64_t length, int64_t value)
+{
+	uint8_t *bytes = items;
+	__m128i needle = _mm_set1_epi8(value);
+	int64_t count = 0;
+	int64_t i = 0;
+
+	for(; i + 16 <= length; i += 16) {
+		__m128i found = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(bytes + i)), needle);
+		count += __builtin_popcount(_mm_movemask_epi8(found));
+	}
+
+	return count + count_bytes(bytes + i, length - i, value);
+}
+
+__attribute__((target("avx2")))
+static int64_t sum_ints_avx2(void *items, int64_t length, int64_t value)
+{
+	int64_t *ints = items;
+	__m256i sum0 = _mm256_setzero_si256(), sum1 = sum0;
+	int64_t i = 0;
+
+	for(; i + 8 <= length; i += 8) {
+		sum0 = _mm256_add_epi64(sum0, _mm256_loadu_si256((__m256i*)(ints + i)));
+		sum1 = _mm256_add_epi64(sum1, _mm256_loadu_si256((__m256i*)(ints + i + 4)));
+	}
+
+	int64_t lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(sum0, sum1));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_ints(ints + i, length - i, 0);
+}
+
+__attribute__((target("avx2")))
+static int64_t extreme_ints_avx2(void *items, int64_t length, int64_t max)
+{
+	int64_t *ints = items;
+	__m256i result0 = _mm256_set1_epi64x(ints[0]), result1 = result0;
+	int64_t i = 0;
+
+	for(; i + 8 <= length; i += 8) {
+		__m256i chunk0 = _mm256_loadu_si256((__m256i*)(ints + i));
+		__m256i chunk1 = _mm256_loadu_si256((__m256i*)(ints + i + 4));
+		__m256i take0 = max ? _mm256_cmpgt_epi64(chunk0, result0) : _mm256_cmpgt_epi64(result0, chunk0);
+		__m256i take1 = max ? _mm256_cmpgt_epi64(chunk1, result1) : _mm256_cmpgt_epi64(result1, chunk1);
+		result0 = _mm256_blendv_epi8(result0, chunk0, take0);
+		result1 = _mm256_blendv_epi8(result1, chunk1, take1);
+	}
+
+	int64_t lanes[9];
+	_mm256_storeu_si256((__m256i*)lanes, result0);
+	_mm256_storeu_si256((__m256i*)(lanes + 4), result1);
+	lanes[8] = i < length ? extreme_ints(ints + i, length - i, max) : lanes[0];
+	return extreme_ints(lanes, 9, max);
+}
+
+__attribute__((target("avx2")))
+static int64_t count_ints_avx2(void *items, int64_t length, int64_t value)
+{
+	int64_t *ints = items;
+	__m256i needle = _mm256_set1_epi64x(value);
+	__m256i count = _mm256_setzero_si256();
+	int64_t i = 0;
+
+	for(; i + 4 <= length; i += 4) {
+		count = _mm256_sub_epi64(count, _mm256_cmpeq_epi64(_mm256_loadu_si256((__m256i*)(ints + i)), needle));
+	}
+
+	int64_t lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, count);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + count_ints(ints + i, length - i, value);
+}
+
+__attribute__((target("avx2")))
+static int64_t find_ints_avx2(void *items, int64_t length, int64_t value)
+{
+	int64_t *ints = items;
+	__m256i needle = _mm256_set1_epi64x(value);
+	int64_t i = 0;
+
+	for(; i + 4 <= length; i += 4) {
+		__m256i found = _mm256_cmpeq_epi64(_mm256_loadu_si256((__m256i*)(ints + i)), needle);
+		int mask = _mm256_movemask_pd(_mm256_castsi256_pd(found));
+		if(mask) return i + __builtin_ctz(mask);
+	}
+
+	int64_t found = find_ints(ints + i, length - i, value);
+	return found < 0 ? -1 : i + found;
+}
+
+__attribute__((target("avx2,popcnt")))
+static int64_t count_bytes_avx2(void *items, int64_t length, int64_t value)
+{
+	uint8_t *bytes = items;
+	__m256i needle = _mm256_set1_epi8(value);
+	int64_t count = 0;
+	int64_t i = 0;
+
+	for(; i + 32 <= length; i += 32) {
+		__m256i found = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*)(bytes + i)), needle);
+		count += __builtin_popcount(_mm256_movemask_epi8(found));
+	}
+
+	return count + count_bytes(bytes + i, length - i, value);
+}
+#endif
+
+static Kernels kernels = {sum_ints, extreme_ints, count_ints, find_ints, count_bytes};
+
+static void __attribute__((constructor)) select_kernels()
+{
+	#ifdef __x86_64__
+	// CRUNCHY_SIMD caps the instruction set: 0 scalar, 1 SSE4.2, 2 AVX2
+	int64_t level = env_int("CRUNCHY_SIMD", 2);
+	__builtin_cpu_init();
+
+	if(level >= 2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+		kernels = (Kernels){sum_ints_avx2, extreme_ints_avx2, count_ints_avx2, find_ints_avx2, count_bytes_avx2};
+	}
+	else if(level >= 1 && __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+		kernels = (Kernels){sum_ints_sse, extreme_ints_sse, count_ints_sse, find_ints_sse, count_bytes_sse};
+	}
+	#endif
+}
+
+static void *kernel_thread(void *arg)
+{
+	KernelChunk *chunk = arg;
+	chunk->result = chunk->kernel(chunk->items, chunk->length, chunk->value);
+	return 0;
+}
+
+static int64_t run_kernel(Kernel kernel, Kernel combine, Array *array, int64_t itemsize, int64_t value)
+{
+	int64_t threads = array->length < PARALLEL_KERNEL_MIN ? 1 : kernel_threads;
+	if(threads <= 1) return kernel(array->items, array->length, value);
+
+	// the caller stays out of safepoints until all chunks are done, so the items can not move meanwhile
+	KernelChunk chunks[MAX_KERNEL_THREADS];
+	pthread_t handles[MAX_KERNEL_THREADS];
+	int64_t started[MAX_KERNEL_THREADS];
+	int64_t results[MAX_KERNEL_THREADS];
+	int64_t chunk_length = (array->length + threads - 1) / threads;
+	sigset_t prof_signal, old_mask;
+	sigemptyset(&prof_signal);
+	sigaddset(&prof_signal, SIGPROF);
+	pthread_sigmask(SIG_BLOCK, &prof_signal, &old_mask);
+
+	for(int64_t i=0; i < threads; i++) {
+		int64_t start = i * chunk_length;
+		int64_t end = start + chunk_length < array->length ? start + chunk_length : array->length;
+		chunks[i] = (KernelChunk){kernel, (char*)array->items + start * itemsize, end - start, value};
+		started[i] = i > 0 && pthread_create(&handles[i], 0, kernel_thread, &chunks[i]) == 0;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old_mask, 0);
+
+	for(int64_t i=0; i < threads; i++) {
+		if(started[i]) pthread_join(handles[i], 0);
+		else kernel_thread(&chunks[i]);
+		results[i] = chunks[i].result;
+	}
+
+	if(combine) return combine(results, threads, value);
+
+	for(int64_t i=0; i < threads; i++) {
+		if(results[i] >= 0) return i * chunk_length + results[i];
+	}
+
+	return -1;
+}
+
+static int64_t has_byte_items(Array *array)
+{
+	return block_type(&array->block)->subtype->kind == TY_BOOL;
+}
+
+int64_t array_sum(Array *array)
+{
+	if(has_byte_items(array)) return run_kernel(kernels.count_bytes, sum_ints, array, 1, 1);
+	return run_kernel(kernels.sum_ints, sum_ints, array, sizeof(int64_t), 0);
+}
+
+int64_t array_min(Array *array)
+{
+	if(array->length == 0) return 0;
+	if(has_byte_items(array)) return run_kernel(find_bytes, 0, array, 1, 0) < 0;
+	return run_kernel(kernels.extreme_ints, extreme_ints, array, sizeof(int64_t), 0);
+}
+
+int64_t array_max(Array *array)
+{
+	if(array->length == 0) return 0;
+	if(has_byte_items(array)) return run_kernel(find_bytes, 0, array, 1, 1) >= 0;
+	return run_kernel(kernels.extreme_ints, extreme_ints, array, sizeof(int64_t), 1);
+}
+
+int64_t array_count(Array *array, int64_t value)
+{
+	if(has_byte_items(array)) return run_kernel(kernels.count_bytes, sum_ints, array, 1, value);
+	return run_kernel(kernels.count_ints, sum_ints, array, sizeof(int64_t), value);
+}
+
+int64_t array_find(Array *array, int64_t value)
+{
+	if(has_byte_items(array)) return run_kernel(find_bytes, 0, array, 1, value);
+	return run_kernel(kernels.find_ints, 0, array, sizeof(int64_t), value);
+}
+
+void array_fill(Array *array, int64_t value)
+{
+	if(has_byte_items(array)) {
+		memset(array->items, value, array->length);
+		return;
+	}
+
+	int64_t *ints = array->items;
+	if(array->length > 0) ints[0] = value;
+
+	// memcpy already has vector code for every CPU, so the filled prefix is copied in doubling steps
+	for(int64_t done = 1; done < array->length;) {
+		int64_t step = done < 4096 ? done : 4096;
+		if(step > array->length - done) step = array->length - done;
+		memcpy(ints + done, ints, step * sizeof(int64_t));
+		done += step;
+	}
+}
+
+void array_copy(Array *dest, Array *source)
+{
+	int64_t length = dest->length < source->length ? dest->length : source->length;
+	int64_t itemsize = has_byte_items(dest) ? 1 : sizeof(int64_t);
+	memmove(dest->items, source->items, length * itemsize);
+}
+
+static int64_t read_arg(Type *type, va_list *args)
+{
+	switch(type->kind) {
+		case TY_INT: return va_arg(*args, int64_t);
+		case TY_BOOL: return va_arg(*args, int) != 0;
+		case TY_FUNC: return (int64_t)va_arg(*args, Function);
+		default: return (int64_t)va_arg(*args, MemoryBlock*);
+	}
+}
+
+static uint64_t mix_hash(uint64_t hash)
+{
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ull;
+	return hash ^ hash >> 33;
+}
+
+static uint64_t hash_key(Type *type, int64_t key)
+{
+	if(type->kind != TY_STRING) return mix_hash(key);
+	String *string = (String*)key;
+	char *chars = string->chars;
+	uint64_t hash = string->length;
+	uint64_t word = 0;
+
+	for(int64_t left = string->length; left > 0; left -= 8, chars += 8) {
+		memcpy(&word, chars, left < 8 ? left : 8);
+		hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+		hash ^= hash >> 29;
+		word = 0;
+	}
+
+	return mix_hash(hash);
+}
+
+static int keys_equal(Type *type, int64_t a, int64_t b)
+{
+	if(a == b) return 1;
+	if(type->kind != TY_STRING) return 0;
+	String *left = (String*)a;
+	String *right = (String*)b;
+	return left->length == right->length && memcmp(left->chars, right->chars, left->length) == 0;
+}
+
+static uint32_t match_ctrl(uint8_t *ctrl, uint8_t byte)
+{
+	#ifdef __x86_64__
+	__m128i group = _mm_loadu_si128((__m128i*)ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(byte)));
+	#else
+	uint32_t mask = 0;
+	for(int64_t i=0; i < MAP_GROUP; i++) mask |= (uint32_t)(ctrl[i] == byte) << i;
+	return mask;
+	#endif
+}
+
+static uint32_t match_free(uint8_t *ctrl)
+{
+	#ifdef __x86_64__
+	return _mm_movemask_epi8(_mm_loadu_si128((__m128i*)ctrl));
+	#else
+	uint32_t mask = 0;
+	for(int64_t i=0; i < MAP_GROUP; i++) mask |= (uint32_t)(ctrl[i] >> 7) << i;
+	return mask;
+	#endif
+}
+
+static int64_t find_slot(Map *map, Type *type, int64_t key, uint64_t hash)
+{
+	if(map->capacity == 0) return -1;
+	int64_t group_mask = map->capacity / MAP_GROUP - 1;
+	int64_t group = hash >> 7 & group_mask;
+	MapSlot *slots = map_slots(map);
+
+	// groups are probed in triangular steps, which visits every group of a power of two table
+	for(int64_t step = 1;; step ++) {
+		uint8_t *ctrl = map->ctrl + group * MAP_GROUP;
+
+		for(uint32_t bits = match_ctrl(ctrl, hash & 0x7f); bits; bits &= bits - 1) {
+			int64_t index = group * MAP_GROUP + __builtin_ctz(bits);
+			if(keys_equal(type->keytype, slots[index].key, key)) return index;
+		}
+
+		if(match_ctrl(ctrl, CTRL_EMPTY)) return -1;
+		group = (group + step) & group_mask;
+	}
+}
+
+static int64_t free_slot(Map *map, uint64_t hash)
+{
+	int64_t group_mask = map->capacity / MAP_GROUP - 1;
+	int64_t group = hash >> 7 & group_mask;
+
+	for(int64_t step = 1;; step ++) {
+		uint32_t bits = match_free(map->ctrl + group * MAP_GROUP);
+		if(bits) return group * MAP_GROUP + __builtin_ctz(bits);
+		group = (group + step) & group_mask;
+	}
+}
+
+static void resize_map(Map *map, Type *type)
+{
+	int64_t capacity = MAP_GROUP;
+	while(capacity * 7 < (map->length + 1) * 16) capacity *= 2;
+	int64_t old_capacity = map->capacity;
+	uint8_t *old_ctrl = map->ctrl;
+	MapSlot *old_slots = map_slots(map);
+	uint8_t *ctrl = new_items(&map->block, table_size(capacity));
+	memset(ctrl, CTRL_EMPTY, capacity);
+	map->ctrl = ctrl;
+	map->capacity = capacity;
+	map->deleted = 0;
+	MapSlot *slots = map_slots(map);
+
+	for(int64_t i=0; i < old_capacity; i++) {
+		if(old_ctrl[i] & CTRL_EMPTY) continue;
+		int64_t index = free_slot(map, hash_key(type->keytype, old_slots[i].key));
+		ctrl[index] = old_ctrl[i];
+		slots[index] = old_slots[i];
+	}
+}
+
+static int64_t default_value(Type *type)
+{
+	switch(type->kind) {
+		case TY_STRING: return (int64_t)new_string(0, "");
+		case TY_ARRAY: return (int64_t)alloc_array(type, 0, 0);
+		case TY_MAP: return (int64_t)new_map(type);
+		case TY_FUNC: return (int64_t)noop;
+		default: return 0;
+	}
+}
+
+// incremental marking traces a snapshot of the heap, so a reference a map drops while marking is marked first
+static void snapshot_ref(Type *type, int64_t ref)
+{
+	if(!is_gc_ref(type) || gc_state != GC_MARKING) return;
+	pthread_mutex_lock(&heap_lock);
+	mark((MemoryBlock*)ref);
+	pthread_mutex_unlock(&heap_lock);
+}
+
+Map *new_map(Type *type)
+{
+	Map *map = new_memory_block(type, sizeof(Map), 0);
+	map->length = 0;
+	map->capacity = 0;
+	map->deleted = 0;
+	map->ctrl = 0;
+	return map;
+}
+
+void map_set(Map *map, ...)
+{
+	Type *type = block_type(&map->block);
+	va_list args;
+	va_start(args, map);
+	int64_t key = read_arg(type->keytype, &args);
+	int64_t value = read_arg(type->subtype, &args);
+	va_end(args);
+	uint64_t hash = hash_key(type->keytype, key);
+	int64_t index = find_slot(map, type, key, hash);
+
+	if(index < 0) {
+		// the table is kept at most 7/8 full, tombstones included, so every probe ends at an empty slot
+		if((map->length + map->deleted + 1) * 8 > map->capacity * 7) resize_map(map, type);
+		index = free_slot(map, hash);
+		if(map->ctrl[index] == CTRL_DELETED) map->deleted --;
+		map->ctrl[index] = hash & 0x7f;
+		map_slots(map)[index].key = key;
+		map->length ++;
+		if(is_gc_ref(type->keytype)) write_barrier(&map->block, (MemoryBlock*)key);
+	}
+	else {
+		snapshot_ref(type->subtype, map_slots(map)[index].value);
+	}
+
+	map_slots(map)[index].value = value;
+	if(is_gc_ref(type->subtype)) write_barrier(&map->block, (MemoryBlock*)value);
+}
+
+int64_t map_get(Map *map, ...)
+{
+	Type *type = block_type(&map->block);
+	va_list args;
+	va_start(args, map);
+	int64_t key = read_arg(type->keytype, &args);
+	va_end(args);
+	int64_t index = find_slot(map, type, key, hash_key(type->keytype, key));
+	if(index < 0) return default_value(type->subtype);
+	return map_slots(map)[index].value;
+}
+
+int64_t map_has(Map *map, ...)
+{
+	Type *type = block_type(&map->block);
+	va_list args;
+	va_start(args, map);
+	int64_t key = read_arg(type->keytype, &args);
+	va_end(args);
+	return find_slot(map, type, key, hash_key(type->keytype, key)) >= 0;
+}
+
+void map_delete(Map *map, ...)
+{
+	Type *type = block_type(&map->block);
+	va_list args;
+	va_start(args, map);
+	int64_t key = read_arg(type->keytype, &args);
+	va_end(args);
+	int64_t index = find_slot(map, type, key, hash_key(type->keytype, key));
+	if(index < 0) return;
+	snapshot_ref(type->keytype, map_slots(map)[index].key);
+	snapshot_ref(type->subtype, map_slots(map)[index].value);
+	map->length --;
+
+	// no probe runs past a group with an empty slot, so only full groups need a tombstone
+	if(match_ctrl(map->ctrl + index / MAP_GROUP * MAP_GROUP, CTRL_EMPTY)) {
+		map->ctrl[index] = CTRL_EMPTY;
+	}
+	else {
+		map->ctrl[index] = CTRL_DELETED;
+		map->deleted ++;
+	}
+}
+
+static void print_value(int64_t value, Type *type)
+{
+	switch(type->kind) {
+		case TY_INT:
+			print_int(value);
+			break;
+		case TY_BOOL:
+			print_bool(value);
+			break;
+		case TY_STRING:
+			print_string((String*)value);
+			break;
+		case TY_FUNC:
+			print_chars("<Function>", 10);
+			break;
+		case TY_ARRAY:
+			print_array((Array*)value, type);
+			break;
+		case TY_MAP:
+			print_map((Map*)value, type);
+			break;
+	}
+}
+
+void print_map(Map *map, Type *type)
+{
+	MapSlot *slots = map_slots(map);
+	print_chars("{", 1);
+
+	for(int64_t i=0, printed=0; i < map->capacity; i++) {
+		if(map->ctrl[i] & CTRL_EMPTY) continue;
+		if(printed ++ > 0) print_chars(", ", 2);
+		print_value(slots[i].key, type->keytype);
+		print_chars(": ", 2);
+		print_value(slots[i].value, type->subtype);
+	}
+
+	print_chars("}", 1);
+}
+
+static void input_error(char *name)
+{
+	fprintf(stderr, "could not read %s\n", name);
+	exit(1);
+}
+
+static String *read_stream(int fd, char *name)
+{
+	int64_t length = 0;
+	int64_t capacity = IN_BUFFER_SIZE;
+	char *chars = check_alloc(malloc(capacity));
+	int64_t parked = park_mutator();
+
+	while(1) {
+		if(length == capacity) chars = check_alloc(realloc(chars, capacity *= 2));
+		ssize_t n = read(fd, chars + length, capacity - length);
+		if(n < 0 && errno == EINTR) continue;
+		if(n < 0) input_error(name);
+		if(n == 0) break;
+		length += n;
+	}
+
+	unpark_mutator(parked);
+	String *string = new_string(length, chars);
+	free(chars);
+	return string;
+}
+
+String *read_file(String *path)
+{
+	current_mutator();
+	char *name = check_alloc(strndup(path->chars, path->length));
+	int fd = open(name, O_RDONLY);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) < 0) input_error(name);
+
+	if(!S_ISREG(st.st_mode) || st.st_size == 0) {
+		String *string = read_stream(fd, name);
+		close(fd);
+		free(name);
+		return string;
+	}
+
+	// the file is mapped behind a page that holds its large object header, so the
+	// collector unmaps it like any other large object once no view refers to it
+	int64_t size = st.st_size;
+	int64_t page = sysconf(_SC_PAGESIZE);
+	int64_t mapped_size = page + ((size + page - 1) & ~(page - 1));
+	LargeObject *large = mmap(0, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(large == MAP_FAILED) input_error(name);
+	char *data = (char*)large + page;
+	if(mmap(data, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) input_error(name);
+	madvise(data, size, MADV_SEQUENTIAL);
+	close(fd);
+	free(name);
+	large->mapped_size = mapped_size;
+
+	// the file pages are not counted as heap, the kernel can drop them at any time
+	pthread_mutex_lock(&heap_lock);
+	link_large_object(large, sizeof(MemoryBlock));
+	pthread_mutex_unlock(&heap_lock);
+	large->block->type = 0;
+
+	String *string = new_view(&t_string, sizeof(StringView), large->block);
+	mutator->stats.view_bytes += size;
+	string->length = size;
+	string->chars = data;
+	return string;
+}
+
+static void fill_input()
+{
+	if(in_start > 0) {
+		memmove(in_buffer, in_buffer + in_start, in_end - in_start);
+		in_end -= in_start;
+		in_start = 0;
+	}
+
+	if(in_end == in_capacity) {
+		in_capacity = in_capacity ? in_capacity * 2 : IN_BUFFER_SIZE;
+		in_buffer = check_alloc(realloc(in_buffer, in_capacity));
+	}
+
+	int64_t parked = park_mutator();
+	ssize_t n;
+	do n = read(0, in_buffer + in_end, in_capacity - in_end);
+	while(n < 0 && errno == EINTR);
+	unpark_mutator(parked);
+	if(n > 0) in_end += n;
+	else in_eof = 1;
+}
+
+static void lock_input()
+{
+	if(pthread_mutex_trylock(&input_lock) == 0) return;
+	int64_t parked = park_mutator();
+	pthread_mutex_lock(&input_lock);
+	unpark_mutator(parked);
+}
+
+static int64_t find_line_end()
+{
+	for(int64_t scanned = in_start;;) {
+		char *newline = scanned < in_end ? memchr(in_buffer + scanned, '\n', in_end - scanned) : 0;
+		if(newline) return newline - in_buffer;
+		if(in_eof) return in_end;
+		scanned = in_end - in_start;
+		fill_input();
+	}
+}
+
+String *read_line()
+{
+	current_mutator();
+	lock_input();
+	int64_t end = find_line_end();
+	int64_t next = end < in_end ? end + 1 : end;
+	if(end > in_start && in_buffer[end - 1] == '\r') end --;
+	String *line = new_string(end - in_start, in_buffer + in_start);
+	in_start = next;
+	pthread_mutex_unlock(&input_lock);
+	return line;
+}
+
+int64_t input_eof()
+{
+	current_mutator();
+	lock_input();
+	if(in_start == in_end && !in_eof) fill_input();
+	int64_t eof = in_start == in_end;
+	pthread_mutex_unlock(&input_lock);
+	return eof;
+}
+
+Array *split_lines(String *string, Type *type)
+{
+	char *chars = string->chars;
+	int64_t length = string->length;
+	int64_t count = length > 0 && chars[length - 1] != '\n';
+
+	for(char *c = chars; (c = memchr(c, '\n', chars + length - c)); c++) {
+		count ++;
+	}
+
+	Array *array = alloc_array(type, count, 0);
+	String **lines = array->items;
+	memset(lines, 0, count * sizeof(String*));
+
+	for(int64_t i=0, start=0; i < count; i++) {
+		char *newline = memchr(chars + start, '\n', length - start);
+		int64_t end = newline ? newline - chars : length;
+		int64_t next = end + 1;
+		if(end > start && chars[end - 1] == '\r') end --;
+		lines[i] = slice_string(string, start, end);
+		write_barrier(&array->block, &lines[i]->block);
+		start = next;
+	}
+
+	return array;
+}
+
+static int has_eight_digits(uint64_t chunk)
+{
+	return ((chunk & 0xf0f0f0f0f0f0f0f0ull) | ((chunk + 0x0606060606060606ull) & 0xf0f0f0f0f0f0f0f0ull) >> 4) ==
+		0x3333333333333333ull;
+}
+
+static uint64_t parse_eight_digits(uint64_t chunk)
+{
+	chunk -= 0x3030303030303030ull;
+	chunk = chunk * 10 + (chunk >> 8);
+	return (
+		(chunk & 0x000000ff000000ffull) * (100 + (1000000ull << 32)) +
+		(chunk >> 16 & 0x000000ff000000ffull) * (1 + (10000ull << 32))
+	) >> 32;
+}
+
+int64_t parse_int(String *string)
+{
+	char *chars = string->chars;
+	char *end = chars + string->length;
+	while(chars < end && (*chars == ' ' || *chars == '\t')) chars ++;
+	int negative = chars < end && *chars == '-';
+	if(chars < end && (*chars == '-' || *chars == '+')) chars ++;
+	uint64_t value = 0;
+
+	#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	for(uint64_t chunk; end - chars >= 8; chars += 8) {
+		memcpy(&chunk, chars, 8);
+		if(!has_eight_digits(chunk)) break;
+		if(__builtin_mul_overflow(value, 100000000, &value) || __builtin_add_overflow(value, parse_eight_digits(chunk), &value)) value = UINT64_MAX;
+	}
+	#endif
+
+	while(chars < end && *chars >= '0' && *chars <= '9') {
+		if(__builtin_mul_overflow(value, 10, &value) || __builtin_add_overflow(value, *chars - '0', &value)) value = UINT64_MAX;
+		chars ++;
+	}
+
+	// numbers out of the int64_t range saturate instead of wrapping
+	uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : INT64_MAX;
+	if(value > limit) value = limit;
+	return negative ? -value : value;
 }
\ No newline at end of file
@@ -0,0 +1,25 @@
+#!/bin/sh
+# compiles every tests/*.cr, runs it once per "# env:" line (or once without) with the .in file (if any) as input
+# and compares the output with the .out file
+cd "$(dirname "$0")/.."
+failed=0
+
+for source in ./tests/*.cr; do
+	name=${source%.cr}
+	./build/crunchy "$source" > /dev/null || { echo "FAIL $source: does not compile"; failed=1; continue; }
+	gcc -O2 -flto -I ./include -pthread -o "$name" "$source.c" ./build/libcrunchyrt.a || { failed=1; continue; }
+	envs=$(sed -n 's/^# env: *//p' "$source")
+	input=/dev/null
+	[ -f "$name.in" ] && input="$name.in"
+
+	echo "${envs:-plain}" | while read -r env; do
+		[ "$env" = plain ] && env=
+		if ! env $env "$name" < "$input" 2>&1 | cmp -s - "$name.out"; then
+			echo "FAIL $source $env"
+			exit 1
+		fi
+	done || failed=1
+done
+
+[ $failed = 0 ] && echo "all tests passed"
+exit $failed